@@ -8,19 +8,57 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+static int sbuf_size = 0;
+static int wpos = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
+}
+
+// copy `n` bytes to the stream buffer at `off`, a word at a time where
+// both sides are equally aligned
+static void sbuf_copy(int off, const uint8_t *src, int n) {
+  volatile uint8_t *dst = (uint8_t *)(uintptr_t)AUDIO_SBUF_ADDR + off;
+  if ((((uintptr_t)dst ^ (uintptr_t)src) & 3) == 0) {
+    for (; n > 0 && ((uintptr_t)dst & 3); n --) *dst ++ = *src ++;
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+      *(volatile uint32_t *)dst = *(const uint32_t *)src;
+    }
+  }
+  for (; n > 0; n --) *dst ++ = *src ++;
 }
 
+// copy the samples to the stream buffer, then commit them by writing
+// the number of new bytes to the count register
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *p = ctl->buf.start;
+  int len = (uint8_t *)ctl->buf.end - p;
+  while (len > 0) {
+    int free = sbuf_size - inl(AUDIO_COUNT_ADDR);
+    if (free == 0) continue;
+    int n = (len < free ? len : free);
+    int first = (n < sbuf_size - wpos ? n : sbuf_size - wpos);
+    sbuf_copy(wpos, p, first);
+    sbuf_copy(0, p + first, n - first);
+    wpos = (wpos + n) % sbuf_size;
+    outl(AUDIO_COUNT_ADDR, n);
+    p += n;
+    len -= n;
+  }
 }
@@ -2,24 +2,124 @@
 #include <nemu.h>
 
 #define SYNC_ADDR (VGACTL_ADDR + 4)
+#define FEAT_ADDR (VGACTL_ADDR + 8)
+#define FEAT_CMD  0x1
+
+#define VGACMD_QUEUE_LO  (VGACMD_ADDR + 0x00)
+#define VGACMD_QUEUE_HI  (VGACMD_ADDR + 0x04)
+#define VGACMD_QUEUE_NUM (VGACMD_ADDR + 0x08)
+#define VGACMD_TAIL      (VGACMD_ADDR + 0x10)
+
+enum { VGACMD_FILL = 1, VGACMD_COPY, VGACMD_BLIT };
+
+typedef struct {
+  uint32_t op;
+  uint32_t x, y, w, h;
+  uint32_t color;
+  uint32_t sx, sy;
+  uint64_t src;
+  uint32_t pitch;
+  uint32_t pad;
+} VGACmd;
+
+// the device runs the queued commands when the tail is written
+#define QUEUE_NUM 16
+static VGACmd queue[QUEUE_NUM];
+static uint32_t tail = 0;
+
+static int width = 0, height = 0;
+static bool has_accel = false;
+
+static void submit(VGACmd *cmd) {
+  queue[tail % QUEUE_NUM] = *cmd;
+  outl(VGACMD_TAIL, ++ tail);
+}
 
 void __am_gpu_init() {
+  uint32_t size = inl(VGACTL_ADDR);
+  width = size >> 16;
+  height = size & 0xffff;
+  // the command queue is only mapped if NEMU reports it
+  has_accel = inl(FEAT_ADDR) & FEAT_CMD;
+  if (has_accel) {
+    outl(VGACMD_QUEUE_LO, (uintptr_t)queue);
+    outl(VGACMD_QUEUE_HI, (uint64_t)(uintptr_t)queue >> 32);
+    outl(VGACMD_QUEUE_NUM, QUEUE_NUM);
+  }
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = has_accel,
+    .width = width, .height = height,
+    .vmemsz = width * height * sizeof(uint32_t)
   };
 }
 
+static inline uint32_t* pixel(int x, int y) {
+  return (uint32_t *)(uintptr_t)FB_ADDR + y * width + x;
+}
+
+// shrink the rectangle at (x, y) to fit in the screen
+static bool clip(int x, int y, int *w, int *h) {
+  if (x < 0 || y < 0 || x >= width || y >= height) return false;
+  if (*w > width - x) *w = width - x;
+  if (*h > height - y) *h = height - y;
+  return *w > 0 && *h > 0;
+}
+
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  if (ctl->pixels != NULL && ctl->w > 0 && ctl->h > 0) {
+    if (has_accel) {
+      submit(&(VGACmd) { .op = VGACMD_BLIT, .x = ctl->x, .y = ctl->y, .w = ctl->w, .h = ctl->h,
+        .src = (uintptr_t)ctl->pixels, .pitch = ctl->w * sizeof(uint32_t) });
+    } else {
+      int w = ctl->w, h = ctl->h;
+      if (clip(ctl->x, ctl->y, &w, &h)) {
+        for (int j = 0; j < h; j ++) {
+          uint32_t *dst = pixel(ctl->x, ctl->y + j), *src = (uint32_t *)ctl->pixels + j * ctl->w;
+          for (int i = 0; i < w; i ++) dst[i] = src[i];
+        }
+      }
+    }
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
 }
 
+void __am_gpu_fill(AM_GPU_FILL_T *ctl) {
+  if (has_accel) {
+    submit(&(VGACmd) { .op = VGACMD_FILL, .x = ctl->x, .y = ctl->y, .w = ctl->w, .h = ctl->h,
+      .color = ctl->color });
+    return;
+  }
+  int w = ctl->w, h = ctl->h;
+  if (!clip(ctl->x, ctl->y, &w, &h)) return;
+  for (int j = 0; j < h; j ++) {
+    uint32_t *dst = pixel(ctl->x, ctl->y + j);
+    for (int i = 0; i < w; i ++) dst[i] = ctl->color;
+  }
+}
+
+void __am_gpu_copy(AM_GPU_COPY_T *ctl) {
+  if (has_accel) {
+    submit(&(VGACmd) { .op = VGACMD_COPY, .x = ctl->x, .y = ctl->y, .w = ctl->w, .h = ctl->h,
+      .sx = ctl->sx, .sy = ctl->sy });
+    return;
+  }
+  int w = ctl->w, h = ctl->h;
+  if (!clip(ctl->x, ctl->y, &w, &h) || !clip(ctl->sx, ctl->sy, &w, &h)) return;
+  // copy in the direction which does not overwrite the source rectangle first
+  bool down = (ctl->y > ctl->sy || (ctl->y == ctl->sy && ctl->x > ctl->sx));
+  for (int k = 0; k < h; k ++) {
+    int j = (down ? h - 1 - k : k);
+    uint32_t *dst = pixel(ctl->x, ctl->y + j), *src = pixel(ctl->sx, ctl->sy + j);
+    if (down) { for (int i = w - 1; i >= 0; i --) dst[i] = src[i]; }
+    else { for (int i = 0; i < w; i ++) dst[i] = src[i]; }
+  }
+}
+
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
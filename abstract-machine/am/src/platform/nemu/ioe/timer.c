@@ -1,11 +1,36 @@
 #include <am.h>
 #include <nemu.h>
 
+#define RTC_PAGE_ADDR (RTC_ADDR + 8)
+
+// kept up to date by NEMU once registered
+static volatile uint64_t time_page = 0;
+static bool has_time_page = false;
+static uint64_t boot_time = 0;
+
+static uint64_t read_time() {
+  if (has_time_page) {
+    uint64_t t;
+    do { t = time_page; } while (t != time_page); // two loads on 32-bit ISAs
+    return t;
+  }
+  uint32_t hi = inl(RTC_ADDR + 4); // latches the low half
+  uint32_t lo = inl(RTC_ADDR);
+  return ((uint64_t)hi << 32) | lo;
+}
+
 void __am_timer_init() {
+  uint64_t addr = (uintptr_t)&time_page;
+  outl(RTC_PAGE_ADDR, (uint32_t)addr);
+  outl(RTC_PAGE_ADDR + 4, addr >> 32);
+  // the address is read back as zero if NEMU does not support the time page
+  has_time_page = (inl(RTC_PAGE_ADDR) == (uint32_t)addr &&
+      inl(RTC_PAGE_ADDR + 4) == (uint32_t)(addr >> 32));
+  boot_time = read_time();
 }
 
 void __am_timer_uptime(AM_TIMER_UPTIME_T *uptime) {
-  uptime->us = 0;
+  uptime->us = read_time() - boot_time;
 }
 
 void __am_timer_rtc(AM_TIMER_RTC_T *rtc) {
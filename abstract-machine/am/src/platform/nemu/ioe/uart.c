@@ -0,0 +1,13 @@
+#include <am.h>
+#include <nemu.h>
+
+#define UART_LSR_ADDR (SERIAL_PORT + 5)
+#define UART_LSR_DR   0x01
+
+void __am_uart_tx(AM_UART_TX_T *send) {
+  outb(SERIAL_PORT, send->data);
+}
+
+void __am_uart_rx(AM_UART_RX_T *recv) {
+  recv->data = (inb(UART_LSR_ADDR) & UART_LSR_DR) ? inb(SERIAL_PORT) : -1;
+}
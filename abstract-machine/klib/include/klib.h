@@ -10,6 +10,9 @@ extern "C" {
 #endif
 
 //#define __NATIVE_USE_KLIB__
+// run memset/memcpy/memmove/memcmp on the host with the semihosting calls
+// of NEMU, which needs riscv and SEMIHOSTING enabled in NEMU
+//#define __KLIB_NEMU_MEMOPS__
 
 // string.h
 void  *memset    (void *s, int c, size_t n);
@@ -4,6 +4,29 @@
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 
+#if defined(__KLIB_NEMU_MEMOPS__) && defined(__PLATFORM_NEMU) && \
+    (defined(__ISA_RISCV32__) || defined(__ISA_RISCV64__))
+#define NEMU_MEMOPS
+enum { SYS_NEMU_MEMCPY = 0x100, SYS_NEMU_MEMMOVE, SYS_NEMU_MEMSET, SYS_NEMU_MEMCMP };
+
+// a semihosting call of NEMU with the arguments in a1-a3
+static inline uintptr_t nemu_memop(uintptr_t op, uintptr_t x, uintptr_t y, size_t n) {
+  register uintptr_t a0 asm("a0") = op;
+  register uintptr_t a1 asm("a1") = x;
+  register uintptr_t a2 asm("a2") = y;
+  register uintptr_t a3 asm("a3") = n;
+  asm volatile(
+    ".option push\n.option norvc\n"
+    ".balign 16\n"
+    "slli x0, x0, 0x1f\n"
+    "ebreak\n"
+    "srai x0, x0, 7\n"
+    ".option pop"
+    : "+r"(a0) : "r"(a1), "r"(a2), "r"(a3) : "memory");
+  return a0;
+}
+#endif
+
 size_t strlen(const char *s) {
   panic("Not implemented");
 }
@@ -29,18 +52,51 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 }
 
 void *memset(void *s, int c, size_t n) {
+#ifdef NEMU_MEMOPS
+  // NEMU only works on RAM, other ranges such as the frame buffer are done
+  // here, through volatile pointers so that the loops are not turned back
+  // into calls to these functions
+  if (nemu_memop(SYS_NEMU_MEMSET, (uintptr_t)s, (uint8_t)c, n) == 0) {
+    for (size_t i = 0; i < n; i ++) ((volatile uint8_t *)s)[i] = c;
+  }
+  return s;
+#endif
   panic("Not implemented");
 }
 
 void *memmove(void *dst, const void *src, size_t n) {
+#ifdef NEMU_MEMOPS
+  if (nemu_memop(SYS_NEMU_MEMMOVE, (uintptr_t)dst, (uintptr_t)src, n) == 0) {
+    volatile uint8_t *d = dst;
+    const volatile uint8_t *s = src;
+    if (d < s) { for (size_t i = 0; i < n; i ++) d[i] = s[i]; }
+    else { for (size_t i = n; i > 0; i --) d[i - 1] = s[i - 1]; }
+  }
+  return dst;
+#endif
   panic("Not implemented");
 }
 
 void *memcpy(void *out, const void *in, size_t n) {
+#ifdef NEMU_MEMOPS
+  if (nemu_memop(SYS_NEMU_MEMCPY, (uintptr_t)out, (uintptr_t)in, n) == 0) {
+    for (size_t i = 0; i < n; i ++) ((volatile uint8_t *)out)[i] = ((const volatile uint8_t *)in)[i];
+  }
+  return out;
+#endif
   panic("Not implemented");
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
+#ifdef NEMU_MEMOPS
+  int ret = (int)nemu_memop(SYS_NEMU_MEMCMP, (uintptr_t)s1, (uintptr_t)s2, n);
+  if (ret != 2) return ret;
+  const volatile uint8_t *p1 = s1, *p2 = s2;
+  for (size_t i = 0; i < n; i ++) {
+    if (p1[i] != p2[i]) return p1[i] - p2[i];
+  }
+  return 0;
+#endif
   panic("Not implemented");
 }
 
@@ -22,6 +22,9 @@ void cpu_exec(uint64_t n);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
+/* run the semihosting call `op` with the arguments at `args`, or in `args`,
+ * `a2` and `a3` for the vendor calls, return its result */
+word_t semihost(vaddr_t pc, word_t op, word_t args, word_t a2, word_t a3);
 
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
@@ -19,6 +19,23 @@
 #define TIMER_HZ 60
 
 typedef void (*alarm_handler_t) ();
+// call `h` every 1/TIMER_HZ second, or every `period_us` us
 void add_alarm_handle(alarm_handler_t h);
+void add_alarm_handle_period(alarm_handler_t h, uint64_t period_us);
+
+#ifndef CONFIG_TARGET_AM
+#include <stdatomic.h>
+
+// set by the alarm thread when some handlers are due
+extern atomic_bool alarm_fired;
+// run the due handlers in the CPU thread
+void alarm_dispatch();
+// run the groups in `mask` regardless of whether they are due, for replaying
+void alarm_run(uint64_t mask);
+
+// call `h` in the CPU thread soon after raise_event() is called by any thread
+int add_event_handle(alarm_handler_t h);
+void raise_event(int id);
+#endif
 
 #endif
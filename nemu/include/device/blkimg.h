@@ -0,0 +1,51 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_BLKIMG_H__
+#define __DEVICE_BLKIMG_H__
+
+#include <common.h>
+
+// a disk image file mapped into the host address space
+typedef struct {
+  const char *path;
+  uint8_t *base;
+  size_t size;
+  int fd;
+#ifdef CONFIG_BLKIMG_OVERLAY
+  // writes go to a sparse delta file, the base image is never modified
+  char *delta_path;
+  int delta_fd;
+  uint8_t *bitmap; // one bit per overlay block, set if the block lives in the delta
+  uint8_t *delta;  // data area of the delta file, laid out like the base image
+#endif
+} BlockImage;
+
+/* map the image file at `path` (read-write and shared, or read-only with a
+ * delta file in overlay mode), return false if there is no such file */
+bool blkimg_open(BlockImage *img, const char *path);
+
+static inline bool blkimg_inside(BlockImage *img, size_t off, size_t len) {
+  return img->base != NULL && off + len <= img->size && off + len >= off;
+}
+
+// copy between the image and a host buffer
+void blkimg_read(BlockImage *img, size_t off, void *buf, size_t len);
+void blkimg_write(BlockImage *img, size_t off, const void *buf, size_t len);
+// copy between the image and guest physical memory
+void blkimg_dma(BlockImage *img, size_t off, paddr_t addr, size_t len, bool to_guest);
+
+#endif
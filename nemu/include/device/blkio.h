@@ -0,0 +1,53 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_BLKIO_H__
+#define __DEVICE_BLKIO_H__
+
+#include <common.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+/* Asynchronous file I/O for block devices. Requests are submitted by the CPU
+ * thread and performed by io_uring, or by a pool of threads if io_uring is
+ * not available. Completed requests are collected in the queue they are
+ * submitted to, whose event is then raised to let the CPU thread reap them. */
+
+enum { BLKIO_READ, BLKIO_WRITE, BLKIO_FLUSH };
+
+typedef struct BlkIOReq {
+  int op;
+  int fd;
+  uint64_t off;
+  struct iovec *iov;
+  int iovcnt;
+  int64_t ret; // bytes transferred, or -errno
+  struct BlkIOQueue *q;
+  struct BlkIOReq *next;
+} BlkIOReq;
+
+typedef struct BlkIOQueue {
+  _Atomic(BlkIOReq *) done;
+  int event;
+} BlkIOQueue;
+
+// `event` is returned by add_event_handle()
+void blkio_queue_init(BlkIOQueue *q, int event);
+void blkio_submit(BlkIOQueue *q, BlkIOReq *req);
+// take all the completed requests of `q`
+BlkIOReq* blkio_reap(BlkIOQueue *q);
+
+#endif
@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+#include <common.h>
+
+// interrupt sources of the PLIC
+enum {
+  IRQ_TIMER,    // not a PLIC source, the CLINT provides the timer interrupt
+  IRQ_SERIAL,
+  IRQ_KEYBOARD,
+  IRQ_DISK,
+  IRQ_VIRTIO_BLK,
+  IRQ_VIRTIO_CONSOLE,
+  NR_IRQ
+};
+
+// local interrupts of a RISC-V hart, as the bits in mip
+enum { IRQ_MSI = 3, IRQ_MTI = 7, IRQ_MEI = 11 };
+
+void dev_raise_intr(int irq);
+
+#endif
@@ -0,0 +1,59 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_JOURNAL_H__
+#define __DEVICE_JOURNAL_H__
+
+#include <common.h>
+
+/* The journal keeps every nondeterministic input observed by the devices,
+ * tagged with the number of guest instructions executed at that time. The
+ * inputs are taken from the journal instead of the host when replaying, so
+ * that the guest goes through exactly the same execution. */
+
+enum { JOURNAL_OFF, JOURNAL_RECORD, JOURNAL_REPLAY };
+enum {
+  J_ALARM, // the mask of the alarm groups dispatched
+  J_TIME,  // a value of get_time()
+  J_KEY,   // a key entering the keyboard controller
+  J_VALUE, // a register value depending on a host thread
+  J_READ,  // bytes read from an input file
+};
+
+extern int journal_mode;
+// the instruction count of the next alarm dispatch when replaying
+extern uint64_t journal_next_alarm;
+
+void init_journal(const char *path, bool replay);
+void journal_flush();
+
+// log `v` when recording, or return the recorded value when replaying
+uint64_t journal_value(int type, uint64_t v);
+/* take the next entry of `type` recorded at the current instruction,
+ * return false if there is no such entry */
+bool journal_take(int type, uint64_t *v);
+// read(), with the data logged when recording, or from the journal when replaying
+ssize_t journal_read(int fd, void *buf, size_t len);
+// return the alarm groups to run now when replaying
+uint64_t journal_take_alarm();
+
+#ifdef CONFIG_JOURNAL
+#define JOURNAL(type, v) journal_value(type, v)
+#else
+#define JOURNAL(type, v) (v)
+#endif
+
+#endif
@@ -19,6 +19,9 @@
 #include <cpu/difftest.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
+// handlers which return or accept the value directly, without going through `space`
+typedef word_t(*io_read_t)(uint32_t offset, int len);
+typedef void(*io_write_t)(uint32_t offset, int len, word_t data);
 uint8_t* new_space(int size);
 
 typedef struct {
@@ -28,26 +31,45 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  io_read_t read;   // take precedence over `callback` if set
+  io_write_t write;
+  // bit i is set if the 4-byte register at offset 4 * i is plain storage without
+  // side effects, accesses to which never invoke any handler
+  uint64_t plain;
+  // bitwise OR of the allowed access lengths, 0 means any length is allowed
+  uint8_t len_mask;
+  uint16_t id;
 } IOMap;
 
+// a growable set of maps, each map is identified by its slot index
+typedef struct {
+  IOMap **map;
+  int nr;
+  int size;
+} IORegistry;
+
+IOMap* io_register(IORegistry *r, const char *name, paddr_t addr,
+        void *space, uint32_t len, io_callback_t callback);
+
 static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
-  int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
-  }
-  return -1;
+#define MAP_PLAIN_MAX (64 * 4)
+
+static inline bool map_plain(IOMap *map, uint32_t offset) {
+  return offset < MAP_PLAIN_MAX && ((map->plain >> (offset / 4)) & 1);
+}
+
+// mark the registers in [offset, offset + len) as plain storage
+static inline void map_set_plain(IOMap *map, uint32_t offset, uint32_t len) {
+  assert(offset % 4 == 0 && offset + len <= MAP_PLAIN_MAX);
+  for (uint32_t i = offset / 4; i < (offset + len + 3) / 4; i ++) map->plain |= 1ull << i;
 }
 
-void add_pio_map(const char *name, ioaddr_t addr,
+IOMap* add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
-void add_mmio_map(const char *name, paddr_t addr,
+IOMap* add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
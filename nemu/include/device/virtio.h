@@ -0,0 +1,106 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_VIRTIO_H__
+#define __DEVICE_VIRTIO_H__
+
+#include <common.h>
+
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+
+#define VIRTIO_F_VERSION_1 32
+#define VIRTQ_MAX_NUM 128
+#define VIRTIO_MAX_QUEUE 2
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} VirtqDesc;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} VirtqAvail;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  struct { uint32_t id, len; } ring[];
+} VirtqUsed;
+
+typedef struct {
+  uint32_t num;
+  uint32_t ready;
+  uint64_t desc_addr, avail_addr, used_addr;
+  // host addresses of the rings in guest memory, valid when ready
+  VirtqDesc *desc;
+  VirtqAvail *avail;
+  VirtqUsed *used;
+  uint16_t last_avail;
+  uint16_t used_idx; // published to the guest by virtq_notify()
+} Virtq;
+
+// a descriptor chain, with its buffers as host addresses in guest memory
+typedef struct {
+  uint16_t head;
+  int nr_seg;
+  struct {
+    uint8_t *buf;
+    uint32_t len;
+    bool write; // written by the device
+  } seg[VIRTQ_MAX_NUM];
+} VirtqElem;
+
+typedef struct VirtioDev {
+  const char *name;
+  uint32_t device_id;
+  uint64_t features;
+  int nr_queue;
+  int irq;
+  void *config;
+  uint32_t config_len;
+  void (*notify)(struct VirtioDev *dev, int q);
+  void (*reset)(struct VirtioDev *dev);
+
+  // transport states
+  uint64_t driver_features;
+  uint32_t features_sel, driver_features_sel;
+  uint32_t queue_sel;
+  uint32_t status;
+  uint32_t isr;
+  Virtq vq[VIRTIO_MAX_QUEUE];
+} VirtioDev;
+
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr);
+
+static inline bool virtq_ready(VirtioDev *dev, int q) {
+  return dev->vq[q].ready;
+}
+// take the next available chain of queue `q`, return false if there is none
+bool virtq_pop(VirtioDev *dev, int q, VirtqElem *elem);
+// return a chain to the guest with `len` bytes written to it
+void virtq_push(VirtioDev *dev, int q, VirtqElem *elem, uint32_t len);
+// publish the returned chains and interrupt the guest if it wants
+void virtq_notify(VirtioDev *dev, int q);
+
+#endif
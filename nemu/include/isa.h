@@ -50,6 +50,8 @@ paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+// set the pending state of interrupt `no`, used by the interrupt controllers
+void isa_set_intr(int no, bool pending);
 
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
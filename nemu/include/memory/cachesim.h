@@ -0,0 +1,26 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __MEMORY_CACHESIM_H__
+#define __MEMORY_CACHESIM_H__
+
+#include <common.h>
+
+// `type` is one of MEM_TYPE_IFETCH, MEM_TYPE_READ and MEM_TYPE_WRITE
+void cachesim_access(paddr_t addr, int len, int type);
+void cachesim_report();
+
+#endif
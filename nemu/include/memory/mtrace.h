@@ -0,0 +1,65 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __MEMORY_MTRACE_H__
+#define __MEMORY_MTRACE_H__
+
+#include <stdint.h>
+#ifndef MTRACE_FORMAT_ONLY
+#include <utils.h>
+#endif
+
+/* On-disk format of the memory trace: a header followed by fixed-size records.
+ * This part is also included by tools/mtrace-decode with MTRACE_FORMAT_ONLY. */
+#define MTRACE_MAGIC   "NEMUMTR"
+#define MTRACE_VERSION 1
+
+enum { MTRACE_IFETCH, MTRACE_READ, MTRACE_WRITE };
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} MTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint64_t vaddr;
+  uint64_t paddr;
+  uint64_t data;
+  uint8_t len;
+  uint8_t type;
+  uint8_t pad[6];
+} MTraceRecord;
+
+#if !defined(MTRACE_FORMAT_ONLY) && defined(CONFIG_MTRACE)
+
+extern MTraceRecord *mtrace_buf_cur, *mtrace_buf_end;
+void mtrace_swap();
+void mtrace_flush();
+
+static inline void mtrace_record(vaddr_t pc, vaddr_t vaddr, paddr_t paddr, int len, int type, word_t data) {
+  if (paddr < CONFIG_MTRACE_ADDR_LOW || paddr > CONFIG_MTRACE_ADDR_HIGH) return;
+  if (pc < CONFIG_MTRACE_PC_LOW || pc > CONFIG_MTRACE_PC_HIGH) return;
+  if (!log_enable()) return;
+  *mtrace_buf_cur ++ = (MTraceRecord) { .pc = pc, .vaddr = vaddr, .paddr = paddr,
+    .data = data, .len = len, .type = type };
+  if (mtrace_buf_cur == mtrace_buf_end) mtrace_swap();
+}
+
+#endif
+
+#endif
@@ -31,7 +31,49 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* Besides pmem, other RAM/ROM regions can be declared at initialization.
+ * Guest writes to read-only regions are reported as errors. */
+typedef struct {
+  const char *name;
+  paddr_t low;
+  paddr_t high;
+  uint8_t *host;
+  bool readonly;
+} MemRegion;
+
+/* `host` can be NULL to let NEMU allocate zero-filled memory for the region */
+const MemRegion* add_mem_region(const char *name, paddr_t addr, size_t size,
+    uint8_t *host, bool readonly);
+/* return a region overlapped with [left, right], or NULL if there is not any */
+const MemRegion* find_mem_region(paddr_t left, paddr_t right);
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* bulk access for the monitor and DMA-capable devices */
+typedef struct {
+  uint8_t *host;
+  size_t len;
+} HostSpan;
+
+/* return the host address of [addr, addr + len) if the whole range is
+ * backed by host memory, or NULL if it is not (e.g. it touches MMIO) */
+uint8_t* paddr_span(paddr_t addr, size_t len);
+/* split [addr, addr + len) into at most `nr_span` host-backed spans,
+ * return the number of spans used, or -1 if the range can not be covered */
+int paddr_gather(paddr_t addr, size_t len, HostSpan *span, int nr_span);
+/* copy between guest physical memory and a host buffer, parts of the
+ * range not backed by host memory go through the bus word by word,
+ * read-only regions are writable in this way to load images into ROM */
+void paddr_read_block(paddr_t addr, void *buf, size_t len);
+void paddr_write_block(paddr_t addr, const void *buf, size_t len);
+/* zero [addr, addr + len), host-backed pages are released instead of
+ * being written, so they are only populated when the guest touches them */
+void paddr_clear_block(paddr_t addr, size_t len);
+#ifndef CONFIG_TARGET_AM
+/* map `len` bytes of file `fd` at offset `off` privately at `addr`,
+ * return false if the range can not be mapped (not host-backed or not page aligned) */
+bool paddr_map_file(paddr_t addr, size_t len, int fd, long off);
+#endif
+
 #endif
@@ -55,6 +55,9 @@
 #define SDHBCT 0x3c /* Host byte count (debug)         - 32 R/W */
 #define SDDATA 0x40 /* Data to/from SD card            - 32 R/W */
 #define SDHBLC 0x50 /* Host block count (SDIO/SDHC)    -  9 R/W */
+#define SDDMAADDR   0x60 /* NEMU DMA address (31:0)    - 32 R/W */
+#define SDDMAADDRHI 0x64 /* NEMU DMA address (63:32)   - 32 R/W */
+#define SDDMACNT    0x68 /* NEMU DMA block count       - 32 R/W */
 
 #define SDCMD_NEW_FLAG			0x8000
 #define SDCMD_FAIL_FLAG			0x4000
@@ -75,6 +78,9 @@
 
 #define PIO_THRESHOLD	1  /* Maximum block count for PIO (0 = always DMA) */
 
+#define NEMU_MAX_REQ_SIZE	524288
+#define NEMU_DMA_BLKSZ		512  /* The DMA mode only moves 512-byte blocks */
+
 struct nemu_host {
 	spinlock_t		lock;
 	struct mutex		mutex;
@@ -95,6 +101,9 @@ struct nemu_host {
 	struct mmc_data		*data;		/* Current data request */
 	bool			data_complete:1;/* Data finished before cmd */
 	bool			use_sbc:1;	/* Send CMD23 */
+
+	void			*dma_buf;	/* Bounce buffer for DMA */
+	dma_addr_t		dma_addr;
 };
 
 static void nemu_reset(struct mmc_host *mmc)
@@ -175,6 +184,11 @@ static void nemu_transfer_pio(struct nemu_host *host)
 	nemu_transfer_block_pio(host, is_read);
 }
 
+static bool nemu_use_dma(struct nemu_host *host, struct mmc_data *data)
+{
+	return host->dma_buf && data->blksz == NEMU_DMA_BLKSZ;
+}
+
 static
 void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 {
@@ -190,6 +204,19 @@ void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 	host->data_complete = false;
 	host->data->bytes_xfered = 0;
 
+	if (nemu_use_dma(host, data)) {
+		/* The device transfers the whole request when the command is sent,
+		 * so just prepare the bounce buffer and the DMA registers here.
+		 */
+		size_t len = data->blocks * data->blksz;
+		if (data->flags & MMC_DATA_WRITE)
+			sg_copy_to_buffer(data->sg, data->sg_len, host->dma_buf, len);
+		writel(lower_32_bits(host->dma_addr), host->ioaddr + SDDMAADDR);
+		writel(upper_32_bits(host->dma_addr), host->ioaddr + SDDMAADDRHI);
+		writel(data->blocks, host->ioaddr + SDDMACNT);
+		return;
+	}
+
   /* Use PIO */
   if (data->flags & MMC_DATA_READ)
     flags |= SG_MITER_TO_SG;
@@ -199,6 +226,24 @@ void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
   host->blocks = data->blocks;
 }
 
+static void nemu_transfer_data(struct nemu_host *host)
+{
+	struct mmc_data *data = host->data;
+	int i;
+
+	if (nemu_use_dma(host, data)) {
+		if (data->flags & MMC_DATA_READ)
+			sg_copy_from_buffer(data->sg, data->sg_len, host->dma_buf,
+					    data->blocks * data->blksz);
+		return;
+	}
+
+	// start PIO right now
+	for (i = 0; i < data->blocks; i ++) {
+		nemu_transfer_pio(host);
+	}
+}
+
 static void nemu_finish_request(struct nemu_host *host)
 {
 	struct mmc_request *mrq;
@@ -316,11 +361,7 @@ static void nemu_finish_command(struct nemu_host *host)
 		host->cmd = NULL;
 		if (nemu_send_command(host, host->mrq->cmd)) {
 			if (host->data) {
-        // start PIO right now
-        for (i = 0; i < host->data->blocks; i ++) {
-          nemu_transfer_pio(host);
-        }
-
+        nemu_transfer_data(host);
         nemu_finish_data(host);
       }
 
@@ -380,11 +421,7 @@ static void nemu_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		}
 	} else if (mrq->cmd && nemu_send_command(host, mrq->cmd)) {
 		if (host->data) {
-      int i;
-      // start PIO right now
-      for (i = 0; i < host->data->blocks; i ++) {
-        nemu_transfer_pio(host);
-      }
+      nemu_transfer_data(host);
       nemu_finish_data(host);
     }
 
@@ -428,7 +465,7 @@ static int nemu_add_host(struct nemu_host *host)
 	mutex_init(&host->mutex);
 
 	mmc->max_segs = 128;
-	mmc->max_req_size = 524288;
+	mmc->max_req_size = NEMU_MAX_REQ_SIZE;
 	mmc->max_seg_size = mmc->max_req_size;
 	mmc->max_blk_size = 1024;
 	mmc->max_blk_count =  65535;
@@ -441,7 +478,7 @@ static int nemu_add_host(struct nemu_host *host)
 		return ret;
 	}
 
-	dev_info(dev, "loaded - DMA %s\n", "disabled");
+	dev_info(dev, "loaded - DMA %s\n", host->dma_buf ? "enabled" : "disabled");
 
 	return 0;
 }
@@ -487,6 +524,11 @@ static int nemu_probe(struct platform_device *pdev)
 
 	host->max_clk = 1000000; //clk_get_rate(clk);
 
+	host->dma_buf = dmam_alloc_coherent(dev, NEMU_MAX_REQ_SIZE,
+					    &host->dma_addr, GFP_KERNEL);
+	if (!host->dma_buf)
+		dev_warn(dev, "unable to allocate DMA buffer, fall back to PIO\n");
+
 	ret = mmc_of_parse(mmc);
 	if (ret)
 		goto err;
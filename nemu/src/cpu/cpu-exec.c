@@ -16,6 +16,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <memory/cachesim.h>
+#include <memory/mtrace.h>
 #include <locale.h>
 #include "../../monitor/sdb/watchpoint.h"
 
@@ -32,6 +34,7 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+void journal_flush();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -83,6 +86,12 @@ static void execute(uint64_t n) {
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
     IFDEF(CONFIG_DEVICE, device_update());
+    word_t intr = isa_query_intr();
+    if (intr != INTR_EMPTY) {
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      // the REF has no devices, so let it take the same interrupt
+      IFDEF(CONFIG_DIFFTEST, ref_difftest_raise_intr(intr));
+    }
   }
 }
 
@@ -93,6 +102,9 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_CACHESIM, cachesim_report());
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
+  IFDEF(CONFIG_JOURNAL, journal_flush());
 }
 
 void assert_fail_msg() {
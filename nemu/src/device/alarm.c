@@ -15,37 +15,143 @@
 
 #include <common.h>
 #include <device/alarm.h>
-#include <sys/time.h>
-#include <signal.h>
+#include <device/journal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-#define MAX_HANDLER 8
+/* Each period has a timerfd watched by the event loop thread. When a timer
+ * expires, the thread marks its group as pending, and the handlers are run
+ * later by the CPU thread in alarm_dispatch(), between two instructions.
+ * An event is a group without period, which is marked by raise_event(). */
 
-static alarm_handler_t handler[MAX_HANDLER] = {};
-static int idx = 0;
+typedef struct {
+  uint64_t period_us; // 0 for an event
+  int fd;
+  atomic_bool pending;
+  alarm_handler_t *handler;
+  int nr_handler;
+} AlarmGroup;
+
+atomic_bool alarm_fired = false;
+
+static AlarmGroup **group = NULL;
+static int nr_group = 0;
+static int epfd = -1;
+
+static void start_timer(AlarmGroup *g) {
+  g->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  Assert(g->fd >= 0, "Can not create timer");
+  struct itimerspec it = {};
+  it.it_value.tv_sec = g->period_us / 1000000;
+  it.it_value.tv_nsec = g->period_us % 1000000 * 1000;
+  it.it_interval = it.it_value;
+  int ret = timerfd_settime(g->fd, 0, &it, NULL);
+  Assert(ret == 0, "Can not set timer");
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = g };
+  ret = epoll_ctl(epfd, EPOLL_CTL_ADD, g->fd, &ev);
+  assert(ret == 0);
+}
+
+static int new_group(uint64_t period_us) {
+  IFDEF(CONFIG_JOURNAL, Assert(nr_group < 64, "too many alarm groups to journal"));
+  AlarmGroup *g = malloc(sizeof(AlarmGroup));
+  assert(g);
+  *g = (AlarmGroup) { .period_us = period_us, .fd = -1 };
+  group = realloc(group, sizeof(AlarmGroup *) * (nr_group + 1));
+  assert(group);
+  group[nr_group] = g;
+  return nr_group ++;
+}
+
+static void add_handler(AlarmGroup *g, alarm_handler_t h) {
+  g->handler = realloc(g->handler, sizeof(alarm_handler_t) * (g->nr_handler + 1));
+  assert(g->handler);
+  g->handler[g->nr_handler ++] = h;
+}
+
+void add_alarm_handle_period(alarm_handler_t h, uint64_t period_us) {
+  assert(period_us > 0);
+  AlarmGroup *g = NULL;
+  for (int i = 0; i < nr_group; i ++) {
+    if (group[i]->period_us == period_us) { g = group[i]; break; }
+  }
+  if (g == NULL) {
+    int id = new_group(period_us); // `group` may be moved by new_group()
+    g = group[id];
+    if (epfd >= 0) start_timer(g);
+  }
+  add_handler(g, h);
+}
+
+int add_event_handle(alarm_handler_t h) {
+  int id = new_group(0);
+  add_handler(group[id], h);
+  return id;
+}
+
+void raise_event(int id) {
+  atomic_store_explicit(&group[id]->pending, true, memory_order_release);
+  atomic_store_explicit(&alarm_fired, true, memory_order_release);
+}
 
 void add_alarm_handle(alarm_handler_t h) {
-  assert(idx < MAX_HANDLER);
-  handler[idx ++] = h;
+  add_alarm_handle_period(h, 1000000 / TIMER_HZ);
+}
+
+static inline void run_group(AlarmGroup *g) {
+  for (int j = 0; j < g->nr_handler; j ++) g->handler[j]();
+}
+
+void alarm_dispatch() {
+  atomic_exchange_explicit(&alarm_fired, false, memory_order_acq_rel);
+#ifdef CONFIG_JOURNAL
+  // the groups to run are journaled before any input taken by their handlers
+  uint64_t mask = 0;
+  for (int i = 0; i < nr_group; i ++) {
+    if (atomic_exchange_explicit(&group[i]->pending, false, memory_order_acquire)) mask |= 1ull << i;
+  }
+  if (mask != 0) alarm_run(JOURNAL(J_ALARM, mask));
+#else
+  for (int i = 0; i < nr_group; i ++) {
+    AlarmGroup *g = group[i];
+    if (atomic_exchange_explicit(&g->pending, false, memory_order_acquire)) run_group(g);
+  }
+#endif
 }
 
-static void alarm_sig_handler(int signum) {
-  int i;
-  for (i = 0; i < idx; i ++) {
-    handler[i]();
+#ifdef CONFIG_JOURNAL
+void alarm_run(uint64_t mask) {
+  for (int i = 0; i < nr_group; i ++) {
+    if ((mask >> i) & 1) run_group(group[i]);
   }
 }
+#endif
+
+static void* alarm_thread(void *arg) {
+  struct epoll_event ev[8];
+  while (true) {
+    int n = epoll_wait(epfd, ev, ARRLEN(ev), -1);
+    for (int i = 0; i < n; i ++) {
+      AlarmGroup *g = ev[i].data.ptr;
+      uint64_t expirations;
+      if (read(g->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+      atomic_store_explicit(&g->pending, true, memory_order_release);
+      atomic_store_explicit(&alarm_fired, true, memory_order_release);
+    }
+  }
+  return NULL;
+}
 
 void init_alarm() {
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = alarm_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  struct itimerval it = {};
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  it.it_interval = it.it_value;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  Assert(epfd >= 0, "Can not create epoll instance");
+  for (int i = 0; i < nr_group; i ++) {
+    if (group[i]->period_us != 0) start_timer(group[i]);
+  }
+
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, alarm_thread, NULL);
+  Assert(ret == 0, "Can not create the alarm thread");
 }
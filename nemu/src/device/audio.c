@@ -15,7 +15,9 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/journal.h>
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 enum {
   reg_freq,
@@ -30,17 +32,83 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
-static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+/* `sbuf` is a ring buffer shared by the guest (producer) and the SDL audio
+ * callback (consumer). The guest copies samples to its own write position in
+ * `sbuf` and then commits them by writing the number of new bytes to
+ * `reg_count`. Reading `reg_count` returns the number of bytes not played yet.
+ * Both positions only grow, so each side updates its own counter and the
+ * callback never takes a lock. */
+static _Atomic uint64_t produced = 0, consumed = 0;
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint64_t head = atomic_load_explicit(&consumed, memory_order_relaxed);
+  uint64_t avail = atomic_load_explicit(&produced, memory_order_acquire) - head;
+  int n = (avail < len ? avail : len);
+  uint32_t pos = head % CONFIG_SB_SIZE;
+  int first = (n < CONFIG_SB_SIZE - pos ? n : CONFIG_SB_SIZE - pos);
+  memcpy(stream, sbuf + pos, first);
+  memcpy(stream + first, sbuf, n - first);
+  if (n < len) memset(stream + n, 0, len - n);  // underrun, play silence
+  atomic_store_explicit(&consumed, head + n, memory_order_release);
+}
+
+static void audio_init() {
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  static bool opened = false;
+  if (opened) SDL_CloseAudio();  // the guest configures the device again
+  else SDL_InitSubSystem(SDL_INIT_AUDIO);
+  opened = (SDL_OpenAudio(&s, NULL) == 0);
+  if (!opened) {
+    Log("Can not open audio device: %s", SDL_GetError());
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
+static word_t audio_read(uint32_t offset, int len) {
+  assert(len == 4);
+  switch (offset / 4) {
+    case reg_count:
+      return JOURNAL(J_VALUE, atomic_load_explicit(&produced, memory_order_relaxed) -
+             atomic_load_explicit(&consumed, memory_order_acquire));
+    default: return audio_base[offset / 4];
+  }
+}
+
+static void audio_write(uint32_t offset, int len, word_t data) {
+  assert(len == 4);
+  switch (offset / 4) {
+    case reg_init: if (data) audio_init(); break;
+    case reg_count: {
+      uint64_t p = atomic_load_explicit(&produced, memory_order_relaxed);
+      Assert(p + data - atomic_load_explicit(&consumed, memory_order_acquire) <= CONFIG_SB_SIZE,
+          "audio stream buffer overflow");
+      atomic_store_explicit(&produced, p + data, memory_order_release);
+      break;
+    }
+    default: panic("do not support offset = %d", offset);
+  }
 }
 
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
+  IOMap *map = add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, NULL);
 #else
-  add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
+  IOMap *map = add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, NULL);
 #endif
+  map->read = audio_read;
+  map->write = audio_write;
+  // the configuration registers are only consumed when `reg_init` is written
+  map_set_plain(map, reg_freq * 4, (reg_sbuf_size - reg_freq + 1) * 4);
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
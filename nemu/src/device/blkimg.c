@@ -0,0 +1,176 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/blkimg.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef CONFIG_BLKIMG_OVERLAY
+/* The delta file is a header, the block bitmap, and then a data area with the
+ * same layout as the base image. It is sparse, so only the blocks written
+ * during this run take space. A block is copied from the base image to the
+ * delta the first time it is written, and read from the delta afterwards. */
+
+#define OVL_SHIFT 12
+#define OVL_BLKSZ (1ul << OVL_SHIFT)
+#define OVL_MAGIC 0x4c564f554d454eull // "NEMUOVL"
+
+typedef struct {
+  uint64_t magic;
+  uint64_t size; // size of the base image
+} OverlayHeader;
+
+#define NR_OVERLAY 4
+static BlockImage *overlays[NR_OVERLAY] = {};
+static int nr_overlay = 0;
+
+static inline bool in_delta(BlockImage *img, size_t blk) {
+  return (img->bitmap[blk / 8] >> (blk % 8)) & 1;
+}
+
+static uint8_t* overlay_block(BlockImage *img, size_t blk, bool is_write) {
+  if (in_delta(img, blk)) return img->delta + (blk << OVL_SHIFT);
+  if (!is_write) return img->base + (blk << OVL_SHIFT);
+  size_t off = blk << OVL_SHIFT;
+  size_t len = (off + OVL_BLKSZ <= img->size ? OVL_BLKSZ : img->size - off);
+  memcpy(img->delta + off, img->base + off, len);
+  img->bitmap[blk / 8] |= 1 << (blk % 8);
+  return img->delta + off;
+}
+
+static void overlay_close(BlockImage *img) {
+  size_t nr_blk = (img->size + OVL_BLKSZ - 1) >> OVL_SHIFT;
+  size_t nr_dirty = 0;
+  for (size_t blk = 0; blk < nr_blk; blk ++) nr_dirty += in_delta(img, blk);
+#ifdef CONFIG_BLKIMG_OVERLAY_COMMIT
+  int fd = open(img->path, O_WRONLY);
+  Assert(fd >= 0, "Can not open '%s' to commit the overlay", img->path);
+  for (size_t blk = 0; blk < nr_blk; blk ++) {
+    if (!in_delta(img, blk)) continue;
+    size_t off = blk << OVL_SHIFT;
+    size_t len = (off + OVL_BLKSZ <= img->size ? OVL_BLKSZ : img->size - off);
+    ssize_t ret = pwrite(fd, img->delta + off, len, off);
+    Assert(ret == len, "Can not commit the overlay to '%s'", img->path);
+  }
+  close(fd);
+  Log("%zu blocks of the overlay are committed to %s", nr_dirty, img->path);
+#endif
+#ifdef CONFIG_BLKIMG_OVERLAY_KEEP
+  msync(img->bitmap, img->delta - img->bitmap, MS_SYNC);
+  Log("%zu blocks written to %s are kept in %s", nr_dirty, img->path, img->delta_path);
+#else
+  unlink(img->delta_path);
+#endif
+}
+
+static void overlay_exit() {
+  for (int i = 0; i < nr_overlay; i ++) overlay_close(overlays[i]);
+}
+
+static void overlay_open(BlockImage *img) {
+  Assert(nr_overlay < NR_OVERLAY, "too many overlays");
+  // devices may share an image, so each of them gets its own delta file
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "%s.delta-%d.%d", img->path, getpid(), nr_overlay);
+  img->delta_path = strdup(buf);
+  int fd = open(img->delta_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not create overlay '%s'", img->delta_path);
+
+  size_t nr_blk = (img->size + OVL_BLKSZ - 1) >> OVL_SHIFT;
+  size_t data_off = ROUNDUP(sizeof(OverlayHeader) + (nr_blk + 7) / 8, PAGE_SIZE);
+  size_t total = data_off + img->size;
+  int ret = ftruncate(fd, total);
+  Assert(ret == 0, "Can not allocate overlay '%s'", img->delta_path);
+  uint8_t *p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map overlay '%s'", img->delta_path);
+  *(OverlayHeader *)p = (OverlayHeader) { .magic = OVL_MAGIC, .size = img->size };
+
+  img->delta_fd = fd;
+  img->bitmap = p + sizeof(OverlayHeader);
+  img->delta = p + data_off;
+
+  if (nr_overlay == 0) atexit(overlay_exit);
+  overlays[nr_overlay ++] = img;
+  Log("Writes to %s go to %s", img->path, img->delta_path);
+}
+#endif
+
+bool blkimg_open(BlockImage *img, const char *path) {
+  *img = (BlockImage) { .path = path, .fd = -1 };
+  if (path == NULL || path[0] == '\0') return false;
+  int fd = open(path, MUXDEF(CONFIG_BLKIMG_OVERLAY, O_RDONLY, O_RDWR));
+  if (fd < 0) return false;
+
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  if (st.st_size == 0) { close(fd); return false; }
+  uint8_t *p = mmap(NULL, st.st_size, MUXDEF(CONFIG_BLKIMG_OVERLAY, PROT_READ, PROT_READ | PROT_WRITE),
+      MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map disk image '%s'", path);
+
+  img->base = p;
+  img->size = st.st_size;
+  img->fd = fd;
+  IFDEF(CONFIG_BLKIMG_OVERLAY, overlay_open(img));
+  return true;
+}
+
+/* return the host address of the image at `off`, and set `*len` to the
+ * number of bytes which can be accessed contiguously there */
+static uint8_t* blkimg_map(BlockImage *img, size_t off, size_t *len, bool is_write) {
+#ifdef CONFIG_BLKIMG_OVERLAY
+  size_t end = ROUNDDOWN(off, OVL_BLKSZ) + OVL_BLKSZ;
+  if (off + *len > end) *len = end - off;
+  return overlay_block(img, off >> OVL_SHIFT, is_write) + (off & (OVL_BLKSZ - 1));
+#else
+  return img->base + off;
+#endif
+}
+
+void blkimg_read(BlockImage *img, size_t off, void *buf, size_t len) {
+  uint8_t *q = buf;
+  while (len > 0) {
+    size_t n = len;
+    uint8_t *p = blkimg_map(img, off, &n, false);
+    memcpy(q, p, n);
+    q += n; off += n; len -= n;
+  }
+}
+
+void blkimg_write(BlockImage *img, size_t off, const void *buf, size_t len) {
+  const uint8_t *q = buf;
+  while (len > 0) {
+    size_t n = len;
+    uint8_t *p = blkimg_map(img, off, &n, true);
+    memcpy(p, q, n);
+    q += n; off += n; len -= n;
+  }
+}
+
+void blkimg_dma(BlockImage *img, size_t off, paddr_t addr, size_t len, bool to_guest) {
+  while (len > 0) {
+    size_t n = len;
+    uint8_t *p = blkimg_map(img, off, &n, !to_guest);
+    if (to_guest) paddr_write_block(addr, p, n);
+    else paddr_read_block(addr, p, n);
+    addr += n; off += n; len -= n;
+  }
+}
@@ -0,0 +1,211 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/blkio.h>
+#include <device/alarm.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static void complete(BlkIOReq *req) {
+  BlkIOQueue *q = req->q;
+  BlkIOReq *head = atomic_load_explicit(&q->done, memory_order_relaxed);
+  do {
+    req->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&q->done, &head, req,
+        memory_order_release, memory_order_relaxed));
+  raise_event(q->event);
+}
+
+static int64_t do_sync(BlkIOReq *req) {
+  ssize_t ret;
+  switch (req->op) {
+    case BLKIO_READ:  ret = preadv(req->fd, req->iov, req->iovcnt, req->off); break;
+    case BLKIO_WRITE: ret = pwritev(req->fd, req->iov, req->iovcnt, req->off); break;
+    default:          ret = fdatasync(req->fd); break;
+  }
+  return (ret < 0 ? -errno : ret);
+}
+
+// the fallback: a pool of threads performing the requests synchronously
+
+#define NR_WORKER 4
+
+static BlkIOReq *pool_head = NULL, *pool_tail = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static bool pool_started = false;
+
+static void* pool_worker(void *arg) {
+  while (true) {
+    pthread_mutex_lock(&pool_lock);
+    while (pool_head == NULL) pthread_cond_wait(&pool_cond, &pool_lock);
+    BlkIOReq *req = pool_head;
+    pool_head = req->next;
+    if (pool_head == NULL) pool_tail = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    req->ret = do_sync(req);
+    complete(req);
+  }
+  return NULL;
+}
+
+static void pool_submit(BlkIOReq *req) {
+  if (!pool_started) {
+    for (int i = 0; i < NR_WORKER; i ++) {
+      pthread_t t;
+      int ret = pthread_create(&t, NULL, pool_worker, NULL);
+      Assert(ret == 0, "Can not create block I/O worker");
+    }
+    pool_started = true;
+    Log("Block I/O is performed by %d threads", NR_WORKER);
+  }
+  req->next = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (pool_tail) pool_tail->next = req;
+  else pool_head = req;
+  pool_tail = req;
+  pthread_cond_signal(&pool_cond);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+#ifdef CONFIG_BLKIO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define URING_ENTRIES 256
+
+static struct {
+  int fd;
+  // submission ring, only accessed by the CPU thread
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  // completion ring, only accessed by the reaper thread
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+} ring = { .fd = -1 };
+
+static int uring_state = 0; // 0: not tried, 1: in use, -1: unavailable
+
+static void* uring_reaper(void *arg) {
+  while (true) {
+    int ret = syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR) panic("io_uring_enter() fails: %s", strerror(errno));
+    unsigned head = *ring.cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail, memory_order_acquire);
+    for (; head != tail; head ++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      BlkIOReq *req = (BlkIOReq *)(uintptr_t)cqe->user_data;
+      req->ret = cqe->res;
+      complete(req);
+    }
+    atomic_store_explicit((_Atomic unsigned *)ring.cq_head, head, memory_order_release);
+  }
+  return NULL;
+}
+
+static bool uring_init() {
+  struct io_uring_params p = {};
+  int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (fd < 0) {
+    Log("io_uring is not available (%s)", strerror(errno));
+    return false;
+  }
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) sq_size = cq_size = (sq_size > cq_size ? sq_size : cq_size);
+  uint8_t *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  uint8_t *cq = (single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING));
+  void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  Assert(sq != MAP_FAILED && cq != MAP_FAILED && sqes != MAP_FAILED, "Can not map io_uring");
+
+  ring.fd = fd;
+  ring.sq_head  = (unsigned *)(sq + p.sq_off.head);
+  ring.sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+  ring.sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring.sqes = sqes;
+  ring.cq_head  = (unsigned *)(cq + p.cq_off.head);
+  ring.cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+  ring.cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, uring_reaper, NULL);
+  Assert(ret == 0, "Can not create the io_uring reaper");
+  Log("Block I/O is performed by io_uring");
+  return true;
+}
+
+// return false if the submission ring is full
+static bool uring_submit(BlkIOReq *req) {
+  unsigned tail = *ring.sq_tail;
+  unsigned head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+  if (tail - head >= URING_ENTRIES) return false;
+  unsigned idx = tail & *ring.sq_mask;
+  struct io_uring_sqe *sqe = &ring.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  switch (req->op) {
+    case BLKIO_READ:  sqe->opcode = IORING_OP_READV; break;
+    case BLKIO_WRITE: sqe->opcode = IORING_OP_WRITEV; break;
+    default:          sqe->opcode = IORING_OP_FSYNC; sqe->fsync_flags = IORING_FSYNC_DATASYNC; break;
+  }
+  sqe->fd = req->fd;
+  if (req->op != BLKIO_FLUSH) {
+    sqe->addr = (uintptr_t)req->iov;
+    sqe->len = req->iovcnt;
+    sqe->off = req->off;
+  }
+  sqe->user_data = (uintptr_t)req;
+  ring.sq_array[idx] = idx;
+  atomic_store_explicit((_Atomic unsigned *)ring.sq_tail, tail + 1, memory_order_release);
+  int ret = syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0);
+  Assert(ret >= 0, "io_uring_enter() fails: %s", strerror(errno));
+  return true;
+}
+#endif
+
+void blkio_queue_init(BlkIOQueue *q, int event) {
+  atomic_init(&q->done, NULL);
+  q->event = event;
+}
+
+void blkio_submit(BlkIOQueue *q, BlkIOReq *req) {
+  req->q = q;
+#ifdef CONFIG_BLKIO_URING
+  if (uring_state == 0) uring_state = (uring_init() ? 1 : -1);
+  if (uring_state == 1 && uring_submit(req)) return;
+#endif
+  pool_submit(req);
+}
+
+BlkIOReq* blkio_reap(BlkIOQueue *q) {
+  BlkIOReq *list = atomic_exchange_explicit(&q->done, NULL, memory_order_acquire);
+  // the list is in the reverse order of completion
+  BlkIOReq *rev = NULL;
+  while (list != NULL) {
+    BlkIOReq *next = list->next;
+    list->next = rev;
+    rev = list;
+    list = next;
+  }
+  return rev;
+}
@@ -0,0 +1,71 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/alarm.h>
+#include <device/intr.h>
+#include <device/journal.h>
+#include <memory/host.h>
+#include <utils.h>
+
+/* Core-local interruptor of a single hart. mtime counts in us. mtimecmp
+ * is compared when it is written and at every CLINT_TICK_US, so the timer
+ * interrupt is raised at most CLINT_TICK_US late. */
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+static uint8_t *clint_base = NULL;
+
+static inline uint64_t* reg64(uint32_t offset) {
+  return (uint64_t *)(clint_base + offset);
+}
+
+static inline bool in_reg64(uint32_t offset, uint32_t reg) {
+  return offset >= reg && offset < reg + 8;
+}
+
+static void clint_update() {
+  isa_set_intr(IRQ_MTI, JOURNAL(J_TIME, get_time()) >= *reg64(CLINT_MTIMECMP));
+}
+
+static word_t clint_read(uint32_t offset, int len) {
+  // sample the clock on reads of the low word only, so that a 32-bit guest
+  // reading the high word next gets a consistent value
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 4) {
+    *reg64(CLINT_MTIME) = JOURNAL(J_TIME, get_time());
+  }
+  return host_read(clint_base + offset, len);
+}
+
+static void clint_write(uint32_t offset, int len, word_t data) {
+  if (in_reg64(offset, CLINT_MTIME)) return; // mtime follows the host clock
+  host_write(clint_base + offset, len, data);
+  if (offset == CLINT_MSIP) isa_set_intr(IRQ_MSI, clint_base[CLINT_MSIP] & 1);
+  else if (in_reg64(offset, CLINT_MTIMECMP)) clint_update();
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  *reg64(CLINT_MTIMECMP) = UINT64_MAX;
+  IOMap *map = add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, NULL);
+  map->read = clint_read;
+  map->write = clint_write;
+  add_alarm_handle_period(clint_update, CONFIG_CLINT_TICK_US);
+}
@@ -16,11 +16,11 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/journal.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
 
-void init_map();
 void init_serial();
 void init_timer();
 void init_vga();
@@ -28,27 +28,35 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_virtio_blk();
+void init_virtio_console();
 void init_alarm();
+void init_clint();
+void init_plic();
 
+void serial_update();
+void timer_update(uint64_t now);
 void send_key(uint8_t, bool);
+void i8042_update();
 void vga_update_screen();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
-
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+extern uint64_t g_nr_guest_inst;
 
 #ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_UI_THREAD
+#include <pthread.h>
+#include <stdatomic.h>
+
+// set by the UI thread, consumed by the simulation thread
+static atomic_bool ui_quit = false;
+#endif
+
+static void poll_events() {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        MUXDEF(CONFIG_UI_THREAD, ui_quit = true, nemu_state.state = NEMU_QUIT);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -63,20 +71,72 @@ void device_update() {
       default: break;
     }
   }
+}
+#endif
+
+static void device_tick() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
+  IFDEF(CONFIG_HAS_KEYBOARD, i8042_update());
+  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+
+#ifdef CONFIG_UI_THREAD
+  if (ui_quit) nemu_state.state = NEMU_QUIT;
+#elif !defined(CONFIG_TARGET_AM)
+  poll_events();
+#endif
+}
+
+void device_update() {
+#ifdef CONFIG_TARGET_AM
+  static uint64_t last = 0;
+  uint64_t now = get_time();
+  IFDEF(CONFIG_HAS_TIMER, timer_update(now));
+  if (now - last < 1000000 / TIMER_HZ) {
+    return;
+  }
+  last = now;
+  device_tick();
+#else
+#ifdef CONFIG_JOURNAL
+  // the handlers run at the recorded instructions instead, whenever they are due
+  if (journal_mode == JOURNAL_REPLAY) {
+    if (g_nr_guest_inst == journal_next_alarm) alarm_run(journal_take_alarm());
+    return;
+  }
+#endif
+  // the due handlers are posted by the alarm thread
+  if (atomic_load_explicit(&alarm_fired, memory_order_relaxed)) alarm_dispatch();
 #endif
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+  // the UI thread keeps draining the event queue by itself
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_UI_THREAD)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
 }
 
+#ifdef CONFIG_UI_THREAD
+void vga_init_screen();
+void vga_present_screen();
+
+static void* ui_thread(void *arg) {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_init_screen());
+  while (true) {
+    poll_events();
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_present_screen());
+    SDL_Delay(1000 / TIMER_HZ);
+  }
+  return NULL;
+}
+#endif
+
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
-  init_map();
 
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
@@ -84,6 +144,17 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_VIRTIO_BLK, init_virtio_blk());
+  IFDEF(CONFIG_HAS_VIRTIO_CONSOLE, init_virtio_console());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+#ifndef CONFIG_TARGET_AM
+  add_alarm_handle(device_tick);
+  init_alarm();
+#endif
+
+#ifdef CONFIG_UI_THREAD
+  pthread_t ui;
+  int ret = pthread_create(&ui, NULL, ui_thread, NULL);
+  assert(ret == 0);
+#endif
 }
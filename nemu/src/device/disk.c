@@ -14,6 +14,77 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <device/blkimg.h>
+
+/* The guest programs `reg_blkno`, `reg_nblk` and `reg_buf`, then writes
+ * `reg_cmd`. The whole request is transferred by DMA between the image and
+ * guest physical memory before the write returns, and a completion interrupt
+ * is raised if `reg_intr_en` is set. */
+
+#define BLKSZ 512
+
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,
+  reg_cmd,
+  reg_blkno,
+  reg_nblk,
+  reg_buf,
+  reg_status,
+  reg_intr_en,
+  nr_reg
+};
+
+enum { CMD_READ = 1, CMD_WRITE = 2 };
+enum { STATUS_OK = 0, STATUS_ERROR = 1 };
+
+static uint32_t *disk_base = NULL;
+static BlockImage img = {};
+
+static bool disk_dma(bool is_write, uint32_t blkno, uint32_t nblk, paddr_t buf) {
+  size_t off = (size_t)blkno * BLKSZ, len = (size_t)nblk * BLKSZ;
+  if (!blkimg_inside(&img, off, len)) return false;
+  blkimg_dma(&img, off, buf, len, !is_write);
+  return true;
+}
+
+static void disk_write(uint32_t offset, int len, word_t data) {
+  assert(len == 4);
+  switch (offset / 4) {
+    case reg_cmd: {
+      bool ok = (data == CMD_READ || data == CMD_WRITE) && disk_dma(data == CMD_WRITE,
+          disk_base[reg_blkno], disk_base[reg_nblk], disk_base[reg_buf]);
+      disk_base[reg_status] = (ok ? STATUS_OK : STATUS_ERROR);
+      if (disk_base[reg_intr_en]) {
+        dev_raise_intr(IRQ_DISK);
+      }
+      break;
+    }
+    case reg_present: case reg_blksz: case reg_blkcnt: break; // read-only
+    default: panic("do not support offset = %d", offset);
+  }
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+  disk_base[reg_blksz] = BLKSZ;
+  if (blkimg_open(&img, CONFIG_DISK_IMG_PATH)) {
+    disk_base[reg_present] = 1;
+    disk_base[reg_blkcnt] = img.size / BLKSZ;
+    Log("Disk image %s, %d blocks", img.path, disk_base[reg_blkcnt]);
+  } else if (CONFIG_DISK_IMG_PATH[0] != '\0') {
+    Log("Can not find disk image: %s", CONFIG_DISK_IMG_PATH);
+  }
+#ifdef CONFIG_HAS_PORT_IO
+  IOMap *map = add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, NULL);
+#else
+  IOMap *map = add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, NULL);
+#endif
+  map->write = disk_write;
+  map->len_mask = 4;
+  map_set_plain(map, reg_blkno * 4, (nr_reg - reg_blkno) * 4);
 }
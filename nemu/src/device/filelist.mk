@@ -15,18 +15,31 @@
 
 DIRS-y += src/device/io
 SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/alarm.c src/device/intr.c
+SRCS-$(CONFIG_JOURNAL) += src/device/journal.c
+SRCS-$(CONFIG_HAS_CLINT) += src/device/clint.c
+SRCS-$(CONFIG_HAS_PLIC) += src/device/plic.c
 SRCS-$(CONFIG_HAS_SERIAL) += src/device/serial.c
 SRCS-$(CONFIG_HAS_TIMER) += src/device/timer.c
 SRCS-$(CONFIG_HAS_KEYBOARD) += src/device/keyboard.c
 SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
+SRCS-$(CONFIG_VGA_CAPTURE) += src/device/vga-capture.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
 SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
+SRCS-$(CONFIG_HAS_VIRTIO_BLK) += src/device/virtio-blk.c
+SRCS-$(CONFIG_BLKIO_ASYNC) += src/device/blkio.c
+SRCS-$(CONFIG_HAS_VIRTIO_CONSOLE) += src/device/virtio-console.c
+ifneq ($(CONFIG_HAS_VIRTIO_BLK)$(CONFIG_HAS_VIRTIO_CONSOLE),)
+SRCS-y += src/device/virtio-mmio.c
+endif
+ifneq ($(CONFIG_HAS_DISK)$(CONFIG_HAS_SDCARD)$(CONFIG_HAS_VIRTIO_BLK),)
+SRCS-y += src/device/blkimg.c
+endif
 
 SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
 
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
-LIBS += -lSDL2
+LIBS += -lSDL2 -lpthread
 endif
 endif
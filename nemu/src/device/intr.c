@@ -13,7 +13,10 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <isa.h>
+#include <device/intr.h>
 
-void dev_raise_intr() {
+void plic_raise(int irq);
+
+void dev_raise_intr(int irq) {
+  IFDEF(CONFIG_HAS_PLIC, if (irq != IRQ_TIMER) plic_raise(irq));
 }
@@ -18,20 +18,42 @@
 #include <memory/vaddr.h>
 #include <device/map.h>
 
-#define IO_SPACE_MAX (2 * 1024 * 1024)
-
-static uint8_t *io_space = NULL;
-static uint8_t *p_space = NULL;
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
 
+// every device gets its own page-aligned backing storage
 uint8_t* new_space(int size) {
-  uint8_t *p = p_space;
-  // page aligned;
-  size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;
-  p_space += size;
-  assert(p_space - io_space < IO_SPACE_MAX);
+  size = ROUNDUP(size, PAGE_SIZE);
+#ifdef CONFIG_TARGET_AM
+  uint8_t *p = malloc(size);
+  assert(p);
+  memset(p, 0, size);
+#else
+  uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(p != MAP_FAILED);
+#endif
   return p;
 }
 
+IOMap* io_register(IORegistry *r, const char *name, paddr_t addr,
+    void *space, uint32_t len, io_callback_t callback) {
+  int id = r->nr ++;
+  if (id == r->size) {
+    r->size = (r->size == 0 ? 16 : r->size * 2);
+    r->map = realloc(r->map, sizeof(IOMap *) * r->size);
+    assert(r->map);
+  }
+  Assert(id < UINT16_MAX, "too many maps");
+
+  IOMap *map = malloc(sizeof(IOMap));
+  assert(map);
+  *map = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
+    .space = space, .callback = callback, .id = id };
+  r->map[id] = map;
+  return map;
+}
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -42,21 +64,25 @@ static void check_bound(IOMap *map, paddr_t addr) {
   }
 }
 
-static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
-  if (c != NULL) { c(offset, len, is_write); }
+static void check_len(IOMap *map, paddr_t addr, int len) {
+  Assert(map->len_mask == 0 || (map->len_mask & len),
+      "%d-byte access to address (" FMT_PADDR ") is not supported by {%s} at pc = " FMT_WORD,
+      len, addr, map->name, cpu.pc);
 }
 
-void init_map() {
-  io_space = malloc(IO_SPACE_MAX);
-  assert(io_space);
-  p_space = io_space;
+static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
+  if (c != NULL) { c(offset, len, is_write); }
 }
 
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  check_len(map, addr, len);
   paddr_t offset = addr - map->low;
-  invoke_callback(map->callback, offset, len, false); // prepare data to read
+  if (!map_plain(map, offset)) {
+    if (map->read != NULL) return map->read(offset, len);
+    invoke_callback(map->callback, offset, len, false); // prepare data to read
+  }
   word_t ret = host_read(map->space + offset, len);
   return ret;
 }
@@ -64,7 +90,16 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  check_len(map, addr, len);
   paddr_t offset = addr - map->low;
+  if (map_plain(map, offset)) {
+    host_write(map->space + offset, len, data);
+    return;
+  }
+  if (map->write != NULL) {
+    map->write(offset, len, data);
+    return;
+  }
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
@@ -15,15 +15,90 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
-#define NR_MAP 16
+static IORegistry maps = {};
+static IOMap *last_map = NULL;
 
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+/* A two-level radix table maps every byte of the 32-bit physical address space
+ * to the id of its map plus one. A leaf covers one page. Pages entirely
+ * covered by a map share a uniform leaf of that map, while pages shared by
+ * several small maps (or partially covered) get a private leaf. */
+#define L1_SHIFT 22
+#define NR_L2 (1 << (L1_SHIFT - PAGE_SHIFT))
+typedef uint16_t MMIOLeaf[PAGE_SIZE];
+
+static MMIOLeaf **mmio_table[1ul << (32 - L1_SHIFT)] = {};
+static MMIOLeaf **uniform_leaf = NULL; // indexed by map id
+static int nr_uniform_leaf = 0;
+
+static MMIOLeaf** l2_of(paddr_t addr, bool alloc) {
+  MMIOLeaf ***l1 = &mmio_table[addr >> L1_SHIFT];
+  if (*l1 == NULL && alloc) {
+    *l1 = calloc(NR_L2, sizeof(MMIOLeaf *));
+    assert(*l1);
+  }
+  return *l1;
+}
+
+static MMIOLeaf* get_uniform_leaf(int id) {
+  if (id >= nr_uniform_leaf) {
+    int n = maps.size;
+    uniform_leaf = realloc(uniform_leaf, sizeof(MMIOLeaf *) * n);
+    assert(uniform_leaf);
+    memset(uniform_leaf + nr_uniform_leaf, 0, sizeof(MMIOLeaf *) * (n - nr_uniform_leaf));
+    nr_uniform_leaf = n;
+  }
+  if (uniform_leaf[id] == NULL) {
+    uniform_leaf[id] = malloc(sizeof(MMIOLeaf));
+    assert(uniform_leaf[id]);
+    for (int i = 0; i < PAGE_SIZE; i ++) (*uniform_leaf[id])[i] = id + 1;
+  }
+  return uniform_leaf[id];
+}
+
+// set every byte in [left, right] to `id + 1`
+static void fill_table(int id, paddr_t left, paddr_t right) {
+  for (uint64_t pg = left >> PAGE_SHIFT; pg <= (right >> PAGE_SHIFT) && pg < (1ul << (32 - PAGE_SHIFT)); pg ++) {
+    paddr_t base = pg << PAGE_SHIFT;
+    MMIOLeaf **leaf = &l2_of(base, true)[pg & (NR_L2 - 1)];
+    paddr_t l = (left > base ? left : base);
+    paddr_t r = (right < base + PAGE_SIZE - 1 ? right : base + PAGE_SIZE - 1);
+    bool whole = (l == base && r == base + PAGE_SIZE - 1);
+    if (*leaf == NULL) {
+      if (whole) { *leaf = get_uniform_leaf(id); continue; }
+      *leaf = calloc(1, sizeof(MMIOLeaf));
+      assert(*leaf);
+    }
+    for (paddr_t a = l; a <= r; a ++) (**leaf)[a - base] = id + 1;
+  }
+}
+
+static inline int lookup_table(paddr_t addr) {
+#ifdef PMEM64
+  if (unlikely(addr >> 32)) {
+    // not covered by the table, it should be rare
+    for (int i = 0; i < maps.nr; i ++) {
+      if (map_inside(maps.map[i], addr)) return i;
+    }
+    return -1;
+  }
+#endif
+  MMIOLeaf **l2 = l2_of(addr, false);
+  if (l2 == NULL) return -1;
+  MMIOLeaf *leaf = l2[(addr >> PAGE_SHIFT) & (NR_L2 - 1)];
+  return (leaf == NULL ? -1 : (*leaf)[addr & PAGE_MASK] - 1);
+}
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  IOMap *map = last_map;
+  if (map == NULL || !map_inside(map, addr)) {
+    int mapid = lookup_table(addr);
+    if (mapid == -1) return NULL;
+    map = last_map = maps.map[mapid];
+  }
+  difftest_skip_ref();
+  return map;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -33,24 +108,23 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 }
 
 /* device interface */
-void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
+IOMap* add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
   paddr_t left = addr, right = addr + len - 1;
-  if (in_pmem(left) || in_pmem(right)) {
-    report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
+  const MemRegion *r = find_mem_region(left, right);
+  if (r != NULL) {
+    report_mmio_overlap(name, left, right, r->name, r->low, r->high);
   }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
+  for (int i = 0; i < maps.nr; i++) {
+    IOMap *m = maps.map[i];
+    if (left <= m->high && right >= m->low) {
+      report_mmio_overlap(name, left, right, m->name, m->low, m->high);
     }
   }
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
-
-  nr_map ++;
+  IOMap *map = io_register(&maps, name, addr, space, len, callback);
+  fill_table(map->id, left, right);
+  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", map->name, map->low, map->high);
+  return map;
 }
 
 /* bus interface */
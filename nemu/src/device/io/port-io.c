@@ -17,33 +17,42 @@
 
 #define PORT_IO_SPACE_MAX 65535
 
-#define NR_MAP 16
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static IORegistry maps = {};
+static IOMap *last_map = NULL;
+
+// every port is mapped to the id of its map plus one
+static uint16_t pio_table[PORT_IO_SPACE_MAX] = {};
+
+static IOMap* fetch_pio_map(ioaddr_t addr) {
+  IOMap *map = last_map;
+  if (map == NULL || !map_inside(map, addr)) {
+    int id = pio_table[addr];
+    assert(id != 0);
+    map = last_map = maps.map[id - 1];
+  }
+  difftest_skip_ref();
+  return map;
+}
 
 /* device interface */
-void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
+IOMap* add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
   assert(addr + len <= PORT_IO_SPACE_MAX);
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
-
-  nr_map ++;
+  IOMap *map = io_register(&maps, name, addr, space, len, callback);
+  for (uint32_t i = 0; i < len; i ++) {
+    assert(pio_table[addr + i] == 0);
+    pio_table[addr + i] = map->id + 1;
+  }
+  Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", map->name, map->low, map->high);
+  return map;
 }
 
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  return map_read(addr, len, &maps[mapid]);
+  return map_read(addr, len, fetch_pio_map(addr));
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  map_write(addr, len, data, &maps[mapid]);
+  map_write(addr, len, data, fetch_pio_map(addr));
 }
@@ -0,0 +1,198 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/journal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The journal file starts with JOURNAL_MAGIC, followed by entries of
+ *   LEB128 instruction count, relative to the previous entry
+ *   1 byte type
+ *   LEB128 value (J_TIME: zigzag delta to the previous time), or
+ *   LEB128 length and the bytes (J_READ) */
+
+#define JOURNAL_MAGIC "NEMUJNL1"
+
+extern uint64_t g_nr_guest_inst;
+
+int journal_mode = JOURNAL_OFF;
+uint64_t journal_next_alarm = UINT64_MAX;
+
+static uint64_t last_inst = 0, last_time = 0;
+
+// recording
+
+static FILE *jfp = NULL;
+
+static void put_uleb(uint64_t v) {
+  do {
+    uint8_t b = v & 0x7f;
+    v >>= 7;
+    fputc(b | (v ? 0x80 : 0), jfp);
+  } while (v);
+}
+
+static void put_head(int type) {
+  put_uleb(g_nr_guest_inst - last_inst);
+  last_inst = g_nr_guest_inst;
+  fputc(type, jfp);
+}
+
+static void put_value(int type, uint64_t v) {
+  put_head(type);
+  if (type == J_TIME) {
+    int64_t d = v - last_time;
+    last_time = v;
+    v = ((uint64_t)d << 1) ^ (d >> 63);
+  }
+  put_uleb(v);
+}
+
+// replaying
+
+static const uint8_t *jbuf = NULL, *jend = NULL, *jpos = NULL;
+
+static struct {
+  uint64_t inst;
+  int type;
+  uint64_t value;
+  const uint8_t *data; // J_READ
+} next;
+
+static uint64_t get_uleb() {
+  uint64_t v = 0;
+  for (int shift = 0; ; shift += 7) {
+    Assert(jpos < jend && shift < 64, "the journal is corrupted");
+    uint8_t b = *jpos ++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return v;
+  }
+}
+
+// decode the next entry, or go live if there is no more
+static void fetch() {
+  if (jpos == jend) {
+    Log("Replay finishes at instruction %" PRIu64 ", inputs are taken from the host since now",
+        g_nr_guest_inst);
+    journal_mode = JOURNAL_OFF;
+    journal_next_alarm = UINT64_MAX;
+    return;
+  }
+  next.inst = last_inst + get_uleb();
+  last_inst = next.inst;
+  Assert(jpos < jend, "the journal is corrupted");
+  next.type = *jpos ++;
+  next.value = get_uleb();
+  if (next.type == J_TIME) {
+    int64_t d = (next.value >> 1) ^ -(int64_t)(next.value & 1);
+    next.value = last_time = last_time + d;
+  } else if (next.type == J_READ) {
+    Assert(next.value <= jend - jpos, "the journal is corrupted");
+    next.data = jpos;
+    jpos += next.value;
+  }
+  journal_next_alarm = (next.type == J_ALARM ? next.inst : UINT64_MAX);
+}
+
+static inline bool next_is(int type) {
+  return journal_mode == JOURNAL_REPLAY && next.inst == g_nr_guest_inst && next.type == type;
+}
+
+uint64_t journal_value(int type, uint64_t v) {
+  switch (journal_mode) {
+    case JOURNAL_RECORD: put_value(type, v); return v;
+    case JOURNAL_REPLAY:
+      Assert(next_is(type), "replay diverges at instruction %" PRIu64
+          ": expect input %d at %" PRIu64 ", but %d is taken", g_nr_guest_inst, next.type, next.inst, type);
+      v = next.value;
+      fetch();
+      return v;
+    default: return v;
+  }
+}
+
+bool journal_take(int type, uint64_t *v) {
+  if (!next_is(type)) return false;
+  *v = next.value;
+  fetch();
+  return true;
+}
+
+ssize_t journal_read(int fd, void *buf, size_t len) {
+  if (journal_mode != JOURNAL_REPLAY) {
+    ssize_t ret = read(fd, buf, len);
+    if (ret > 0 && journal_mode == JOURNAL_RECORD) {
+      put_value(J_READ, ret);
+      fwrite(buf, ret, 1, jfp);
+    }
+    return ret;
+  }
+  if (!next_is(J_READ)) return 0;
+  Assert(next.value <= len, "replay diverges at instruction %" PRIu64
+      ": %" PRIu64 " bytes are recorded for a read of %zu bytes", g_nr_guest_inst, next.value, len);
+  ssize_t ret = next.value;
+  memcpy(buf, next.data, ret);
+  fetch();
+  return ret;
+}
+
+uint64_t journal_take_alarm() {
+  uint64_t mask = 0;
+  bool ret = journal_take(J_ALARM, &mask);
+  assert(ret);
+  return mask;
+}
+
+void journal_flush() {
+  if (jfp) fflush(jfp);
+}
+
+static void journal_close() {
+  if (jfp) fclose(jfp);
+}
+
+void init_journal(const char *path, bool replay) {
+  if (path == NULL) return;
+  if (!replay) {
+    jfp = fopen(path, "wb");
+    Assert(jfp, "Can not open '%s'", path);
+    setvbuf(jfp, NULL, _IOFBF, 1 << 20);
+    fputs(JOURNAL_MAGIC, jfp);
+    atexit(journal_close);
+    journal_mode = JOURNAL_RECORD;
+    Log("Recording the inputs to %s", path);
+    return;
+  }
+
+  int fd = open(path, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", path);
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  size_t size = st.st_size;
+  Assert(size >= strlen(JOURNAL_MAGIC), "'%s' is not a journal", path);
+  jbuf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(jbuf != MAP_FAILED);
+  close(fd);
+  Assert(memcmp(jbuf, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) == 0, "'%s' is not a journal", path);
+  jpos = jbuf + strlen(JOURNAL_MAGIC);
+  jend = jbuf + size;
+  journal_mode = JOURNAL_REPLAY;
+  Log("Replaying the inputs from %s", path);
+  fetch();
+}
@@ -14,6 +14,8 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
+#include <device/journal.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
@@ -50,6 +52,40 @@ static void init_keymap() {
   MAP(_KEYS, SDL_KEYMAP)
 }
 
+#ifdef CONFIG_UI_THREAD
+#include <stdatomic.h>
+
+/* Keys are produced by the UI thread and consumed by the simulation thread,
+ * so the queue is a lock-free single-producer/single-consumer ring. */
+#define KEY_QUEUE_LEN 1024
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static atomic_int key_f = 0, key_r = 0;
+
+static void key_enqueue(uint32_t am_scancode) {
+  int r = atomic_load_explicit(&key_r, memory_order_relaxed);
+  int next = (r + 1) % KEY_QUEUE_LEN;
+  if (next == atomic_load_explicit(&key_f, memory_order_acquire)) {
+    return; // the guest does not read the keyboard, drop the key
+  }
+  key_queue[r] = am_scancode;
+  atomic_store_explicit(&key_r, next, memory_order_release);
+}
+
+static bool key_pending() {
+  return atomic_load_explicit(&key_f, memory_order_relaxed) !=
+    atomic_load_explicit(&key_r, memory_order_acquire);
+}
+
+static uint32_t key_dequeue() {
+  uint32_t key = _KEY_NONE;
+  int f = atomic_load_explicit(&key_f, memory_order_relaxed);
+  if (f != atomic_load_explicit(&key_r, memory_order_acquire)) {
+    key = key_queue[f];
+    atomic_store_explicit(&key_f, (f + 1) % KEY_QUEUE_LEN, memory_order_release);
+  }
+  return key;
+}
+#else
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
 static int key_f = 0, key_r = 0;
@@ -60,6 +96,10 @@ static void key_enqueue(uint32_t am_scancode) {
   Assert(key_r != key_f, "key queue overflow!");
 }
 
+static bool key_pending() {
+  return key_f != key_r;
+}
+
 static uint32_t key_dequeue() {
   uint32_t key = _KEY_NONE;
   if (key_f != key_r) {
@@ -68,6 +108,53 @@ static uint32_t key_dequeue() {
   }
   return key;
 }
+#endif
+
+#ifdef CONFIG_JOURNAL
+/* The guest reads the keys from a second queue, which they enter at the
+ * ticks in the simulation thread, where they are journaled. When replaying,
+ * they come from the journal, and the keys from the host are dropped. */
+static uint32_t sim_queue[KEY_QUEUE_LEN] = {};
+static int sim_f = 0, sim_r = 0;
+
+static void sim_enqueue(uint32_t am_scancode) {
+  sim_queue[sim_r] = am_scancode;
+  sim_r = (sim_r + 1) % KEY_QUEUE_LEN;
+}
+
+static bool sim_full() {
+  return (sim_r + 1) % KEY_QUEUE_LEN == sim_f;
+}
+
+static bool sim_pending() {
+  return sim_f != sim_r;
+}
+
+static uint32_t sim_dequeue() {
+  uint32_t key = _KEY_NONE;
+  if (sim_f != sim_r) {
+    key = sim_queue[sim_f];
+    sim_f = (sim_f + 1) % KEY_QUEUE_LEN;
+  }
+  return key;
+}
+
+static void key_intake() {
+  if (journal_mode == JOURNAL_REPLAY) {
+    while (key_pending()) key_dequeue();
+    uint64_t key;
+    while (!sim_full() && journal_take(J_KEY, &key)) sim_enqueue(key);
+  } else {
+    while (!sim_full() && key_pending()) sim_enqueue(JOURNAL(J_KEY, key_dequeue()));
+  }
+}
+#endif
+
+// raise the keyboard interrupt while there are keys to read
+void i8042_update() {
+  IFDEF(CONFIG_JOURNAL, key_intake());
+  if (MUXDEF(CONFIG_JOURNAL, sim_pending(), key_pending())) dev_raise_intr(IRQ_KEYBOARD);
+}
 
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != _KEY_NONE) {
@@ -78,6 +165,9 @@ void send_key(uint8_t scancode, bool is_keydown) {
 #else // !CONFIG_TARGET_AM
 #define _KEY_NONE 0
 
+void i8042_update() {
+}
+
 static uint32_t key_dequeue() {
   AM_INPUT_KEYBRD_T ev = io_read(AM_INPUT_KEYBRD);
   uint32_t am_scancode = ev.keycode | (ev.keydown ? KEYDOWN_MASK : 0);
@@ -87,19 +177,24 @@ static uint32_t key_dequeue() {
 
 static uint32_t *i8042_data_port_base = NULL;
 
-static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
-  assert(!is_write);
+static word_t i8042_data_read(uint32_t offset, int len) {
   assert(offset == 0);
-  i8042_data_port_base[0] = key_dequeue();
+  return MUXDEF(CONFIG_JOURNAL, sim_dequeue(), key_dequeue());
+}
+
+static void i8042_data_write(uint32_t offset, int len, word_t data) {
+  panic("do not support write");
 }
 
 void init_i8042() {
   i8042_data_port_base = (uint32_t *)new_space(4);
   i8042_data_port_base[0] = _KEY_NONE;
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_io_handler);
+  IOMap *map = add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, NULL);
 #else
-  add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
+  IOMap *map = add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, NULL);
 #endif
+  map->read = i8042_data_read;
+  map->write = i8042_data_write;
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
 }
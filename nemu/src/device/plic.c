@@ -0,0 +1,108 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/intr.h>
+
+/* Platform-level interrupt controller with a single context (M-mode of
+ * hart 0). All the states are bitmaps over the sources, so whether an
+ * interrupt can be delivered is checked with a few ANDs. */
+
+#define PLIC_PRIORITY  0x000000
+#define PLIC_PENDING   0x001000
+#define PLIC_ENABLE    0x002000
+#define PLIC_THRESHOLD 0x200000
+#define PLIC_CLAIM     0x200004
+#define PLIC_SIZE      0x200008
+
+static_assert(NR_IRQ <= 32, "the bitmaps of the PLIC hold 32 sources");
+#define IRQ_MASK ((uint32_t)((1ull << NR_IRQ) - 1) & ~1u) // source 0 does not exist
+
+static uint32_t priority[NR_IRQ] = {};
+static uint32_t threshold = 0;
+static uint32_t pending = 0;  // raised and not claimed
+static uint32_t enable = 0;
+static uint32_t eligible = 0; // priority above the threshold
+static uint32_t claimed = 0;  // claimed and not completed
+
+static void plic_update() {
+  isa_set_intr(IRQ_MEI, (pending & enable & eligible & ~claimed) != 0);
+}
+
+static void update_eligible() {
+  eligible = 0;
+  for (int i = 1; i < NR_IRQ; i ++) {
+    if (priority[i] > threshold) eligible |= 1u << i;
+  }
+  plic_update();
+}
+
+void plic_raise(int irq) {
+  assert(irq > 0 && irq < NR_IRQ);
+  pending |= 1u << irq;
+  plic_update();
+}
+
+// return the deliverable source with the highest priority, or 0 if none
+static uint32_t plic_claim() {
+  uint32_t ready = pending & enable & eligible & ~claimed;
+  uint32_t id = 0;
+  for (int i = 1; i < NR_IRQ; i ++) {
+    if ((ready & (1u << i)) && (id == 0 || priority[i] > priority[id])) id = i;
+  }
+  if (id != 0) {
+    pending &= ~(1u << id);
+    claimed |= 1u << id;
+    plic_update();
+  }
+  return id;
+}
+
+static word_t plic_read(uint32_t offset, int len) {
+  switch (offset) {
+    case PLIC_PENDING:   return pending;
+    case PLIC_ENABLE:    return enable;
+    case PLIC_THRESHOLD: return threshold;
+    case PLIC_CLAIM:     return plic_claim();
+  }
+  if (offset < PLIC_PRIORITY + 4 * NR_IRQ) return priority[offset / 4];
+  return 0;
+}
+
+static void plic_write(uint32_t offset, int len, word_t data) {
+  switch (offset) {
+    case PLIC_PENDING: break; // read-only
+    case PLIC_ENABLE: enable = data & IRQ_MASK; plic_update(); break;
+    case PLIC_THRESHOLD: threshold = data & 7; update_eligible(); break;
+    case PLIC_CLAIM: // complete
+      if (data < NR_IRQ) { claimed &= ~(1u << data); plic_update(); }
+      break;
+    default:
+      if (offset > PLIC_PRIORITY && offset < PLIC_PRIORITY + 4 * NR_IRQ) {
+        priority[offset / 4] = data & 7;
+        update_eligible();
+      }
+  }
+}
+
+void init_plic() {
+  uint8_t *space = new_space(PLIC_SIZE);
+  IOMap *map = add_mmio_map("plic", CONFIG_PLIC_MMIO, space, PLIC_SIZE, NULL);
+  map->read = plic_read;
+  map->write = plic_write;
+  map->len_mask = 4;
+}
@@ -14,6 +14,8 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/blkimg.h>
+#include <memory/paddr.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +30,14 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
-// right after sending the actual read/write commands.
+// No IRQ is supported, so the driver must be modified to start PIO right after
+// sending the actual read/write commands.
+//
+// Besides PIO through SDDATA, a non-standard DMA mode is supported: if SDDMACNT
+// is non-zero when a data command is sent, SDDMACNT 512-byte blocks are
+// transferred between the card and guest physical memory at SDDMAADDR{HI}
+// before the command returns, and SDDMACNT is cleared. Requests with other
+// block sizes must use PIO.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,10 +45,11 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, __PAD20, __PAD21, __PAD22,
+  SDDMAADDR, SDDMAADDRHI, SDDMACNT
 };
 
-static FILE *fp = NULL;
+static BlockImage img = {};
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
@@ -48,11 +57,43 @@ static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+static paddr_t dma_addr() {
+  return (paddr_t)(((uint64_t)base[SDDMAADDRHI] << 32) | base[SDDMAADDR]);
+}
+
+// See section 8.1 JEDEC Standard JED84-A441
+static uint32_t ext_csd_word(uint32_t off) {
+  switch (off) {
+    case 192: return 2; // EXT_CSD_REV
+    case 212: return MEMORY_SIZE / 512;
+    default: return 0;
+  }
+}
+
+static size_t card_pos() {
+  return (blk_addr << 9) + addr;
+}
+
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  if (base[SDDMACNT] != 0) {
+    size_t len = (size_t)base[SDDMACNT] * 512;
+    if (!blkimg_inside(&img, card_pos(), len)) {
+      Log("DMA out of the card image: block = %ld, count = %d", blk_addr, base[SDDMACNT]);
+    } else {
+      blkimg_dma(&img, card_pos(), dma_addr(), len, !is_write);
+    }
+    base[SDDMACNT] = 0;
+  }
+}
+
+static void read_ext_csd_dma() {
+  uint32_t buf[512 / 4];
+  for (int i = 0; i < ARRLEN(buf); i ++) buf[i] = ext_csd_word(i * 4);
+  paddr_write_block(dma_addr(), buf, sizeof(buf));
+  base[SDDMACNT] = 0;
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -73,7 +114,10 @@ static void sdcard_handle_cmd(int cmd) {
       base[SDRSP2] = 0x0f508000 | (C_SIZE >> 2) | (READ_BL_LEN << 16);
       base[SDRSP3] = 0x9026012a;
       break;
-    case MMC_SEND_EXT_CSD: read_ext_csd = true; addr = 0; break;
+    case MMC_SEND_EXT_CSD:
+      if (base[SDDMACNT] != 0) read_ext_csd_dma();
+      else { read_ext_csd = true; addr = 0; }
+      break;
     case MMC_SLEEP_AWAKE: break;
     case MMC_APP_CMD: break;
     case MMC_SET_RELATIVE_ADDR: break;
@@ -100,19 +144,13 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
       break;
     case SDDATA:
        if (read_ext_csd) {
-         // See section 8.1 JEDEC Standard JED84-A441
-         uint32_t data;
-         switch (addr) {
-           case 192: data = 2; break; // EXT_CSD_REV
-           case 212: data = MEMORY_SIZE / 512; break;
-           default: data = 0;
-         }
-         base[SDDATA] = data;
+         base[SDDATA] = ext_csd_word(addr);
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else {
+         if (blkimg_inside(&img, card_pos(), 4)) {
+           if (!write_cmd) blkimg_read(&img, card_pos(), &base[SDDATA], 4);
+           else blkimg_write(&img, card_pos(), &base[SDDATA], 4);
+         }
        }
        addr += 4;
        break;
@@ -124,11 +162,14 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
 
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
-  add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  IOMap *map = add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  map_set_plain(map, SDARG * 4, 4);
+  map_set_plain(map, SDRSP0 * 4, (SDRSP3 - SDRSP0 + 1) * 4);
+  map_set_plain(map, SDDMAADDR * 4, (SDDMACNT - SDDMAADDR + 1) * 4);
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  if (!blkimg_open(&img, CONFIG_SDCARD_IMG_PATH)) {
+    Log("Can not find sdcard image: %s", CONFIG_SDCARD_IMG_PATH);
+  }
 }
@@ -15,37 +15,164 @@
 
 #include <utils.h>
 #include <device/map.h>
+#include <device/intr.h>
+#include <device/journal.h>
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+enum {
+  CH_OFFSET,   // RBR on read, THR on write
+  IER_OFFSET,
+  IIR_OFFSET,  // IIR on read, FCR on write
+  LCR_OFFSET,
+  MCR_OFFSET,
+  LSR_OFFSET,
+  MSR_OFFSET,
+  SCR_OFFSET,
+};
+
+#define IER_RX    0x01
+#define FCR_CLRRX 0x02
+#define LCR_DLAB  0x80
+#define LSR_DR    0x01
+#define LSR_THRE  0x20
+#define LSR_TEMT  0x40
+#define IIR_FIFO  0xc0
+#define IIR_NONE  0x01
+#define IIR_RX    0x04
 
 static uint8_t *serial_base = NULL;
+static uint8_t divisor[2]; // DLL and DLM, which replace RBR/THR and IER while DLAB is set
 
+#ifdef CONFIG_TARGET_AM
+static void serial_putc(char ch) { putch(ch); }
+#else
+/* Guest output is collected here and written to the host stderr with a
+ * single syscall when a line is completed, when the buffer is full, in
+ * device_update() and on exit. */
+static char obuf[CONFIG_SERIAL_OBUF_SIZE];
+static int nr_obuf = 0;
+
+static void serial_flush() {
+  if (nr_obuf == 0) return;
+  fwrite(obuf, 1, nr_obuf, stderr);
+  nr_obuf = 0;
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  obuf[nr_obuf ++] = ch;
+  if (ch == '\n' || nr_obuf == sizeof(obuf)) serial_flush();
+}
+#endif
+
+// the 16-byte receiver FIFO of 16550
+#define RX_FIFO_SIZE 16
+static uint8_t rx_fifo[RX_FIFO_SIZE];
+static int rx_head = 0, rx_count = 0;
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+static int rx_fd = -1;
+
+static void serial_rx_poll() {
+  while (rx_fd >= 0 && rx_count < RX_FIFO_SIZE) {
+    int tail = (rx_head + rx_count) % RX_FIFO_SIZE;
+    int n = (tail >= rx_head ? RX_FIFO_SIZE - tail : rx_head - tail);
+    ssize_t ret = MUXDEF(CONFIG_JOURNAL, journal_read, read)(rx_fd, rx_fifo + tail, n);
+    if (ret <= 0) break; // no more input for now, or no writer attached
+    rx_count += ret;
+  }
+  if (rx_count > 0 && (serial_base[IER_OFFSET] & IER_RX)) {
+    dev_raise_intr(IRQ_SERIAL);
+  }
+}
+
+static void init_rx() {
+  const char *path = CONFIG_SERIAL_INPUT_PATH;
+  if (strcmp(path, "-") == 0) {
+    rx_fd = dup(STDIN_FILENO);
+  } else {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+      int ret = mkfifo(path, 0666);
+      Assert(ret == 0, "Can not create %s", path);
+    }
+    // open with O_RDWR so that reading a FIFO without writers does not get EOF
+    rx_fd = open(path, O_RDWR);
+  }
+  Assert(rx_fd >= 0, "Can not open %s for serial input", path);
+  fcntl(rx_fd, F_SETFL, fcntl(rx_fd, F_GETFL) | O_NONBLOCK);
+  Log("Serial input from %s", path);
+}
+#endif
+
+static uint8_t rx_pop() {
+  if (rx_count == 0) return 0;
+  uint8_t ch = rx_fifo[rx_head];
+  rx_head = (rx_head + 1) % RX_FIFO_SIZE;
+  rx_count --;
+  return ch;
+}
+
+static word_t serial_read(uint32_t offset, int len) {
+  assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+  // refill on demand, so that a guest polling the UART is not throttled
+  // to one FIFO per device update
+  if (rx_count == 0 && ((offset == CH_OFFSET && !dlab) || offset == LSR_OFFSET)) {
+    serial_rx_poll();
+  }
+#endif
+  switch (offset) {
+    case CH_OFFSET: return (dlab ? divisor[0] : rx_pop());
+    case IER_OFFSET: return (dlab ? divisor[1] : serial_base[IER_OFFSET]);
+    case IIR_OFFSET:
+      return IIR_FIFO | ((rx_count > 0 && (serial_base[IER_OFFSET] & IER_RX)) ? IIR_RX : IIR_NONE);
+    case LSR_OFFSET: return LSR_THRE | LSR_TEMT | (rx_count > 0 ? LSR_DR : 0);
+    default: return serial_base[offset];
+  }
 }
 
-static void serial_io_handler(uint32_t offset, int len, bool is_write) {
+static void serial_write(uint32_t offset, int len, word_t data) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
-      if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      if (dlab) divisor[0] = data;
+      else serial_putc(data);
       break;
-    default: panic("do not support offset = %d", offset);
+    case IER_OFFSET:
+      if (dlab) divisor[1] = data;
+      else serial_base[IER_OFFSET] = data;
+      break;
+    case IIR_OFFSET: if (data & FCR_CLRRX) rx_head = rx_count = 0; break;
+    case LSR_OFFSET: break; // read-only
+    default: serial_base[offset] = data; break;
   }
 }
 
+void serial_update() {
+  IFNDEF(CONFIG_TARGET_AM, serial_flush());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, serial_rx_poll());
+}
+
 void init_serial() {
   serial_base = new_space(8);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, 8, serial_io_handler);
+  IOMap *map = add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, 8, NULL);
 #else
-  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
+  IOMap *map = add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, NULL);
 #endif
+  map->read = serial_read;
+  map->write = serial_write;
 
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_rx());
 }
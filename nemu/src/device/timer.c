@@ -14,35 +14,115 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
+#include <device/journal.h>
 #include <device/alarm.h>
+#include <memory/paddr.h>
+#include <memory/host.h>
 #include <utils.h>
 
+enum {
+  reg_us_lo,
+  reg_us_hi,
+  reg_page_lo, // guest physical address of the time page,
+  reg_page_hi, // registered when the high half is written
+  nr_reg
+};
+
 static uint32_t *rtc_port_base = NULL;
 
-static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
-  assert(offset == 0 || offset == 4);
-  if (!is_write && offset == 4) {
-    uint64_t us = get_time();
-    rtc_port_base[0] = (uint32_t)us;
-    rtc_port_base[1] = us >> 32;
-  }
+#if CONFIG_RTC_GRANULARITY_US == 0
+static uint64_t rtc_now() {
+  return JOURNAL(J_TIME, get_time());
+}
+
+void timer_update(uint64_t now) {
+}
+#else
+/* The time is refreshed by an alarm every CONFIG_RTC_GRANULARITY_US, so
+ * reading the registers never queries the host clock. */
+static uint64_t last_update = 0;
+
+static uint64_t rtc_now() {
+  return last_update;
+}
+
+#ifdef CONFIG_RTC_TIME_PAGE
+/* The time page holds the current time in us as an aligned 64-bit
+ * value. NEMU stores it whenever the time is refreshed, so the guest
+ * can read the clock with plain loads instead of MMIO accesses. */
+static uint64_t *time_page = NULL;
+#endif
+
+void timer_update(uint64_t now) {
+  // on AM this is polled by device_update(), otherwise it is called by the alarm
+  IFDEF(CONFIG_TARGET_AM, if (now - last_update < CONFIG_RTC_GRANULARITY_US) return);
+  last_update = now;
+  IFDEF(CONFIG_RTC_TIME_PAGE, if (time_page != NULL) *time_page = now);
 }
 
 #ifndef CONFIG_TARGET_AM
+static void rtc_refresh() {
+  timer_update(JOURNAL(J_TIME, get_time()));
+}
+#endif
+#endif
+
+// reading the high half latches the low half, which is then read as plain storage
+static word_t rtc_read(uint32_t offset, int len) {
+  assert(len == 4);
+  if (offset == reg_us_hi * 4) {
+    uint64_t us = rtc_now();
+    rtc_port_base[reg_us_lo] = (uint32_t)us;
+    rtc_port_base[reg_us_hi] = us >> 32;
+  }
+  return rtc_port_base[offset / 4];
+}
+
+/* Without the time page, writes to its registers are ignored and they are
+ * read as zero, so the guest can tell whether the page is registered by
+ * reading the address back. */
+static void rtc_write(uint32_t offset, int len, word_t data) {
+  if (offset < reg_page_lo * 4) return; // the time is read-only
+#ifdef CONFIG_RTC_TIME_PAGE
+  host_write((uint8_t *)rtc_port_base + offset, len, data);
+  if (offset + len <= reg_page_hi * 4) return;
+  paddr_t addr = ((uint64_t)rtc_port_base[reg_page_hi] << 32) | rtc_port_base[reg_page_lo];
+  if (addr == 0) { time_page = NULL; return; }
+  Assert(in_pmem(addr) && in_pmem(addr + 7) && addr % 8 == 0,
+      "invalid address of the time page " FMT_PADDR, addr);
+  time_page = (uint64_t *)guest_to_host(addr);
+  *time_page = last_update;
+#endif
+}
+
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
+    dev_raise_intr(IRQ_TIMER);
   }
 }
 #endif
 
 void init_timer() {
-  rtc_port_base = (uint32_t *)new_space(8);
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  rtc_port_base = (uint32_t *)new_space(space_size);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("rtc", CONFIG_RTC_PORT, rtc_port_base, 8, rtc_io_handler);
+  IOMap *map = add_pio_map ("rtc", CONFIG_RTC_PORT, rtc_port_base, space_size, NULL);
 #else
-  add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
+  IOMap *map = add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, space_size, NULL);
+#endif
+  map->read = rtc_read;
+  map->write = rtc_write;
+  map_set_plain(map, 0, 4);
+#if CONFIG_RTC_GRANULARITY_US != 0
+  last_update = JOURNAL(J_TIME, get_time());
+#endif
+#ifndef CONFIG_TARGET_AM
+  // with CLINT, the timer interrupt is raised by CLINT instead
+  IFNDEF(CONFIG_HAS_CLINT, add_alarm_handle(timer_intr));
+#if CONFIG_RTC_GRANULARITY_US != 0
+  add_alarm_handle_period(rtc_refresh, CONFIG_RTC_GRANULARITY_US);
+#endif
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
 }
@@ -0,0 +1,131 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+#include <pthread.h>
+#ifdef CONFIG_VGA_CAPTURE_Y4M
+#include <device/alarm.h> // for TIMER_HZ, the frame rate
+#endif
+
+/* Frames are copied into `pending` by the simulation thread and encoded by a
+ * background thread. If the writer falls behind, the pending frame is replaced
+ * by the newer one instead of stalling the simulation. */
+
+static int width = 0, height = 0;
+static FILE *fp = NULL;
+static uint8_t *out = NULL;  // one encoded frame
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static uint32_t *pending = NULL, *spare = NULL;
+static bool has_pending = false;
+static bool busy = false;  // the writer is encoding a frame
+
+#ifdef CONFIG_VGA_CAPTURE_Y4M
+// full-range BT.601, in 8-bit fixed point
+static inline uint8_t clamp(int x) { return (x < 0 ? 0 : (x > 255 ? 255 : x)); }
+
+static size_t encode(const uint32_t *fb) {
+  int n = width * height;
+  uint8_t *y = out + 6, *u = y + n, *v = u + n;
+  memcpy(out, "FRAME\n", 6);
+  for (int i = 0; i < n; i ++) {
+    int r = (fb[i] >> 16) & 0xff, g = (fb[i] >> 8) & 0xff, b = fb[i] & 0xff;
+    y[i] = clamp((  77 * r + 150 * g +  29 * b + 128) >> 8);
+    u[i] = clamp(((-43 * r -  85 * g + 128 * b + 128) >> 8) + 128);
+    v[i] = clamp(((128 * r - 107 * g -  21 * b + 128) >> 8) + 128);
+  }
+  return 6 + 3 * n;
+}
+
+static void write_header() {
+  fprintf(fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+      width, height, TIMER_HZ, CONFIG_VGA_CAPTURE_INTERVAL);
+}
+#else
+static size_t encode(const uint32_t *fb) {
+  int n = width * height;
+  uint8_t *p = out + sprintf((char *)out, "P6\n%d %d\n255\n", width, height);
+  for (int i = 0; i < n; i ++) {
+    *p ++ = (fb[i] >> 16) & 0xff;
+    *p ++ = (fb[i] >> 8) & 0xff;
+    *p ++ = fb[i] & 0xff;
+  }
+  return p - out;
+}
+
+// every image carries its own header
+static void write_header() {}
+#endif
+
+static void* capture_thread(void *arg) {
+  while (true) {
+    pthread_mutex_lock(&lock);
+    while (!has_pending) pthread_cond_wait(&cond, &lock);
+    uint32_t *fb = pending;
+    pending = spare;
+    spare = fb;
+    has_pending = false;
+    busy = true;
+    pthread_mutex_unlock(&lock);
+
+    // `spare` is only touched by this thread until the next swap
+    size_t len = encode(fb);
+    size_t ret = fwrite(out, 1, len, fp);
+    Assert(ret == len, "Can not write to %s", CONFIG_VGA_CAPTURE_PATH);
+    fflush(fp);
+
+    pthread_mutex_lock(&lock);
+    busy = false;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+void vga_capture(const uint32_t *fb) {
+  pthread_mutex_lock(&lock);
+  memcpy(pending, fb, width * height * sizeof(uint32_t));
+  has_pending = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+// make sure the last frame reaches the file before NEMU exits
+static void capture_flush() {
+  pthread_mutex_lock(&lock);
+  while (has_pending || busy) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+void init_vga_capture(int w, int h) {
+  width = w;
+  height = h;
+  fp = fopen(CONFIG_VGA_CAPTURE_PATH, "wb");
+  Assert(fp, "Can not open '%s'", CONFIG_VGA_CAPTURE_PATH);
+  write_header();
+
+  pending = malloc(w * h * sizeof(uint32_t));
+  spare = malloc(w * h * sizeof(uint32_t));
+  out = malloc(64 + 3 * w * h);
+  assert(pending && spare && out);
+
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, capture_thread, NULL);
+  assert(ret == 0);
+  atexit(capture_flush);
+  Log("Capture the screen to %s", CONFIG_VGA_CAPTURE_PATH);
+}
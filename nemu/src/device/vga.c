@@ -15,6 +15,8 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,7 +36,62 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+// bits of the feature register, the third word of vgactl
+#define VGA_FEAT_CMD 0x1 // the command queue of VGA_ACCEL is present
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
+/* The screen is divided into bands of BAND_H rows. Guest writes to `vmem`
+ * grow the dirty rectangle of the bands they touch, and only these
+ * rectangles are uploaded when the guest writes the sync register. */
+#define BAND_H 16
+#define MAX_BAND ((600 + BAND_H - 1) / BAND_H)
+
+typedef struct {
+  uint32_t x0, y0, x1, y1; // inclusive, clean if x0 > x1
+} DirtyRect;
+
+static DirtyRect dirty[MAX_BAND];
+static bool any_dirty = false;
+
+static void reset_rects(DirtyRect *r) {
+  for (int i = 0; i < MAX_BAND; i ++) {
+    r[i] = (DirtyRect) { .x0 = UINT32_MAX, .y0 = UINT32_MAX, .x1 = 0, .y1 = 0 };
+  }
+}
+
+static void clear_dirty() {
+  reset_rects(dirty);
+  any_dirty = false;
+}
+
+static void mark_dirty(uint32_t pixel) {
+  uint32_t w = screen_width();
+  uint32_t x = pixel % w, y = pixel / w;
+  if (y >= screen_height()) return;
+  DirtyRect *r = &dirty[y / BAND_H];
+  if (x < r->x0) r->x0 = x;
+  if (x > r->x1) r->x1 = x;
+  if (y < r->y0) r->y0 = y;
+  if (y > r->y1) r->y1 = y;
+  any_dirty = true;
+}
+
+#ifdef CONFIG_VGA_ACCEL
+// mark the rectangle at (x, y) of w * h pixels, which is inside the screen
+static void mark_dirty_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  for (uint32_t b = y / BAND_H; b <= (y + h - 1) / BAND_H; b ++) {
+    DirtyRect *r = &dirty[b];
+    uint32_t y0 = (b * BAND_H > y ? b * BAND_H : y);
+    uint32_t y1 = ((b + 1) * BAND_H - 1 < y + h - 1 ? (b + 1) * BAND_H - 1 : y + h - 1);
+    if (x < r->x0) r->x0 = x;
+    if (x + w - 1 > r->x1) r->x1 = x + w - 1;
+    if (y0 < r->y0) r->y0 = y0;
+    if (y1 > r->y1) r->y1 = y1;
+  }
+  any_dirty = true;
+}
+#endif
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
@@ -55,8 +112,12 @@ static void init_screen() {
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void update_rect(const DirtyRect *r, const uint32_t *fb) {
+  SDL_Rect rect = { .x = r->x0, .y = r->y0, .w = r->x1 - r->x0 + 1, .h = r->y1 - r->y0 + 1 };
+  SDL_UpdateTexture(texture, &rect, fb + r->y0 * SCREEN_W + r->x0, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present_screen() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -64,28 +125,264 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
+static inline void update_rect(const DirtyRect *r, const uint32_t *fb) {
+  // the pixels passed to AM must be contiguous, so draw whole rows
+  uint32_t w = screen_width();
+  io_write(AM_GPU_FBDRAW, 0, r->y0, (uint32_t *)fb + r->y0 * w, w, r->y1 - r->y0 + 1, false);
+}
+
+static inline void present_screen() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+#endif
+
+#ifdef CONFIG_UI_THREAD
+#include <pthread.h>
+
+/* The simulation thread copies the dirty parts of `vmem` into `snapshot`, and
+ * the UI thread uploads them from there. Publishing never waits for the UI
+ * thread: if it is busy with the snapshot, the dirty rectangles are kept and
+ * published again at the next device tick, even if the guest does not sync. */
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t *snapshot = NULL;
+static DirtyRect pending[MAX_BAND];
+static bool any_pending = false;
+static bool publish_again = false;
+
+static inline void update_screen() {
+  publish_again = false;
+  if (!any_dirty) return;
+  if (pthread_mutex_trylock(&snapshot_lock) != 0) {
+    publish_again = true;
+    return;
+  }
+  for (int i = 0; i < MAX_BAND; i ++) {
+    DirtyRect *r = &dirty[i], *p = &pending[i];
+    if (r->x0 > r->x1) continue;
+    for (uint32_t y = r->y0; y <= r->y1; y ++) {
+      uint32_t off = y * SCREEN_W + r->x0;
+      memcpy(snapshot + off, (uint32_t *)vmem + off, (r->x1 - r->x0 + 1) * sizeof(uint32_t));
+    }
+    if (r->x0 < p->x0) p->x0 = r->x0;
+    if (r->x1 > p->x1) p->x1 = r->x1;
+    if (r->y0 < p->y0) p->y0 = r->y0;
+    if (r->y1 > p->y1) p->y1 = r->y1;
+  }
+  any_pending = true;
+  pthread_mutex_unlock(&snapshot_lock);
+  clear_dirty();
+}
+
+/* called by the UI thread */
+void vga_init_screen() {
+  init_screen();
+}
+
+void vga_present_screen() {
+  pthread_mutex_lock(&snapshot_lock);
+  bool present = any_pending;
+  if (any_pending) {
+    for (int i = 0; i < MAX_BAND; i ++) {
+      if (pending[i].x0 <= pending[i].x1) update_rect(&pending[i], snapshot);
+    }
+    reset_rects(pending);
+    any_pending = false;
+  }
+  pthread_mutex_unlock(&snapshot_lock);
+  if (present) present_screen();
+}
+#else
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  if (!any_dirty) return;
+  for (int i = 0; i < MAX_BAND; i ++) {
+    if (dirty[i].x0 <= dirty[i].x1) update_rect(&dirty[i], vmem);
+  }
+  present_screen();
+  clear_dirty();
 }
 #endif
 #endif
 
+#ifdef CONFIG_VGA_CAPTURE
+void init_vga_capture(int w, int h);
+void vga_capture(const uint32_t *fb);
+
+static bool vmem_changed = true;
+
+static inline void capture_screen() {
+  static int nr_sync = 0;
+  if (++ nr_sync < CONFIG_VGA_CAPTURE_INTERVAL) return;
+  nr_sync = 0;
+  if (!vmem_changed) return; // the same as the last captured frame
+  vga_capture(vmem);
+  vmem_changed = false;
+}
+#endif
+
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+static void vmem_write(uint32_t offset, int len, word_t data) {
+  host_write((uint8_t *)vmem + offset, len, data);
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  mark_dirty(offset / sizeof(uint32_t));
+  if (len > sizeof(uint32_t)) mark_dirty((offset + len - 1) / sizeof(uint32_t));
+#endif
+  IFDEF(CONFIG_VGA_CAPTURE, vmem_changed = true);
+}
+#endif
+
+#ifdef CONFIG_VGA_ACCEL
+/* 2D acceleration. The guest puts commands into a ring in its memory, and
+ * writes the number of commands ever queued to VGACMD_TAIL. They are run
+ * at once, and VGACMD_HEAD catches up with the tail. */
+#define VGACMD_QUEUE_LO  0x00
+#define VGACMD_QUEUE_HI  0x04
+#define VGACMD_QUEUE_NUM 0x08
+#define VGACMD_HEAD      0x0c
+#define VGACMD_TAIL      0x10
+#define VGACMD_SIZE      0x20
+
+enum { VGACMD_FILL = 1, VGACMD_COPY, VGACMD_BLIT };
+
+typedef struct {
+  uint32_t op;
+  uint32_t x, y, w, h; // the destination rectangle in the screen
+  uint32_t color;      // FILL
+  uint32_t sx, sy;     // COPY: the source rectangle in the screen
+  uint64_t src;        // BLIT: guest physical address of the source pixels
+  uint32_t pitch;      // BLIT: bytes per source row
+  uint32_t pad;
+} VGACmd;
+
+static uint32_t *vgacmd_base = NULL;
+
+static inline uint32_t* pixel_at(uint32_t x, uint32_t y) {
+  return (uint32_t *)vmem + y * screen_width() + x;
+}
+
+// shrink the rectangle (x, y, w, h) to fit in the screen
+static inline bool clip(uint32_t x, uint32_t y, uint32_t *w, uint32_t *h) {
+  uint32_t sw = screen_width(), sh = screen_height();
+  if (x >= sw || y >= sh) return false;
+  if (*w > sw - x) *w = sw - x;
+  if (*h > sh - y) *h = sh - y;
+  return *w > 0 && *h > 0;
+}
+
+static void cmd_fill(VGACmd *c) {
+  uint32_t *row = pixel_at(c->x, c->y);
+  uint8_t b = c->color;
+  if (c->color == b * 0x01010101u) {
+    for (uint32_t j = 0; j < c->h; j ++) memset(pixel_at(c->x, c->y + j), b, c->w * sizeof(uint32_t));
+    return;
+  }
+  for (uint32_t i = 0; i < c->w; i ++) row[i] = c->color;
+  for (uint32_t j = 1; j < c->h; j ++) memcpy(pixel_at(c->x, c->y + j), row, c->w * sizeof(uint32_t));
+}
+
+static void cmd_copy(VGACmd *c) {
+  // move the rows in the order which does not overwrite the source before it is read
+  bool down = (c->y > c->sy);
+  for (uint32_t k = 0; k < c->h; k ++) {
+    uint32_t j = (down ? c->h - 1 - k : k);
+    memmove(pixel_at(c->x, c->y + j), pixel_at(c->sx, c->sy + j), c->w * sizeof(uint32_t));
+  }
+}
+
+static void cmd_blit(VGACmd *c) {
+  for (uint32_t j = 0; j < c->h; j ++) {
+    paddr_read_block(c->src + (uint64_t)j * c->pitch, pixel_at(c->x, c->y + j), c->w * sizeof(uint32_t));
+  }
+}
+
+static void run_cmd(VGACmd *c) {
+  if (!clip(c->x, c->y, &c->w, &c->h)) return;
+  switch (c->op) {
+    case VGACMD_FILL: cmd_fill(c); break;
+    case VGACMD_COPY:
+      if (!clip(c->sx, c->sy, &c->w, &c->h)) return;
+      cmd_copy(c);
+      break;
+    case VGACMD_BLIT: cmd_blit(c); break;
+    default: Log("unknown VGA command %d", c->op); return;
+  }
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, mark_dirty_rect(c->x, c->y, c->w, c->h));
+  IFDEF(CONFIG_VGA_CAPTURE, vmem_changed = true);
+}
+
+static void run_queue() {
+  uint32_t num = vgacmd_base[VGACMD_QUEUE_NUM / 4];
+  uint32_t head = vgacmd_base[VGACMD_HEAD / 4], tail = vgacmd_base[VGACMD_TAIL / 4];
+  if (num == 0) return;
+  if (tail - head > num) {
+    Log("VGA command queue overflows, %u commands are dropped", tail - head - num);
+    head = tail - num;
+  }
+  paddr_t queue = ((uint64_t)vgacmd_base[VGACMD_QUEUE_HI / 4] << 32) | vgacmd_base[VGACMD_QUEUE_LO / 4];
+  for (; head != tail; head ++) {
+    VGACmd c;
+    paddr_read_block(queue + (head % num) * sizeof(VGACmd), &c, sizeof(c));
+    run_cmd(&c);
+  }
+  vgacmd_base[VGACMD_HEAD / 4] = head;
+}
+
+static void vgacmd_write(uint32_t offset, int len, word_t data) {
+  if (offset == VGACMD_HEAD) return;
+  vgacmd_base[offset / 4] = data;
+  if (offset == VGACMD_TAIL) run_queue();
+}
+
+static void init_vgacmd() {
+  vgacmd_base = (uint32_t *)new_space(VGACMD_SIZE);
+#ifdef CONFIG_HAS_PORT_IO
+  IOMap *map = add_pio_map ("vgacmd", CONFIG_VGA_CMD_PORT, vgacmd_base, VGACMD_SIZE, NULL);
+#else
+  IOMap *map = add_mmio_map("vgacmd", CONFIG_VGA_CMD_MMIO, vgacmd_base, VGACMD_SIZE, NULL);
+#endif
+  map->write = vgacmd_write;
+  map->len_mask = 4;
+}
+#endif
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[1] != 0) {
+    IFDEF(CONFIG_VGA_CAPTURE, capture_screen());
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    vgactl_port_base[1] = 0;
+  }
+#if defined(CONFIG_VGA_SHOW_SCREEN) && defined(CONFIG_UI_THREAD)
+  else if (publish_again) update_screen();
+#endif
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+  vgactl_port_base = (uint32_t *)new_space(12);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  vgactl_port_base[2] = MUXDEF(CONFIG_VGA_ACCEL, VGA_FEAT_CMD, 0);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 12, NULL);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 12, NULL);
 #endif
 
   vmem = new_space(screen_size());
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+  IOMap *map = add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  map->write = vmem_write;
+#else
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+#endif
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  Assert(screen_height() <= MAX_BAND * BAND_H, "screen is too high");
+#ifdef CONFIG_UI_THREAD
+  snapshot = (uint32_t *)new_space(screen_size());
+  reset_rects(pending);
+#else
+  init_screen();
+#endif
+  memset(vmem, 0, screen_size());
+  clear_dirty();
+#endif
+  IFDEF(CONFIG_VGA_CAPTURE, init_vga_capture(screen_width(), screen_height()));
+  IFDEF(CONFIG_VGA_ACCEL, init_vgacmd());
 }
@@ -0,0 +1,195 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/virtio.h>
+#include <device/blkimg.h>
+#include <device/intr.h>
+#ifdef CONFIG_BLKIO_ASYNC
+#include <device/alarm.h>
+#include <device/blkio.h>
+#include <sched.h>
+#endif
+
+#define VIRTIO_ID_BLOCK 2
+#define SECTOR_SIZE 512
+
+enum { VIRTIO_BLK_T_IN = 0, VIRTIO_BLK_T_OUT = 1, VIRTIO_BLK_T_FLUSH = 4, VIRTIO_BLK_T_GET_ID = 8 };
+enum { VIRTIO_BLK_S_OK, VIRTIO_BLK_S_IOERR, VIRTIO_BLK_S_UNSUPP };
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} VirtioBlkReqHdr;
+
+static struct {
+  uint64_t capacity; // in sectors
+} config = {};
+
+static BlockImage img = {};
+static VirtioDev dev = {};
+static VirtqElem elem;
+
+#define IN_FLIGHT ((uint32_t)-1)
+
+#ifdef CONFIG_BLKIO_ASYNC
+/* A request in flight. Every one holds a descriptor chain, so there are
+ * not more of them than the size of the queue. */
+typedef struct {
+  BlkIOReq io;
+  struct iovec iov[VIRTQ_MAX_NUM];
+  uint16_t head;
+  uint8_t *status;
+  uint32_t len;  // bytes to write to the chain if the request succeeds
+  uint32_t gen;
+} BlkSlot;
+
+static BlkSlot slot[VIRTQ_MAX_NUM];
+static int free_slot[VIRTQ_MAX_NUM], nr_free = 0;
+static BlkIOQueue ioq;
+static uint32_t gen = 0; // increased on reset, to drop the stale completions
+
+/* Submit the request to the backend, with the data buffers of the guest as
+ * the iovecs. Return false if the request is malformed, or if there is no
+ * free slot, and let the synchronous path handle it. */
+static bool blk_submit(VirtqElem *e, int op, size_t off) {
+  int n = e->nr_seg;
+  if (nr_free == 0) return false;
+  BlkSlot *s = &slot[free_slot[nr_free - 1]];
+  size_t len = 0;
+  for (int i = 1; i < n - 1; i ++) {
+    if (e->seg[i].write != (op == BLKIO_READ)) return false;
+    s->iov[i - 1] = (struct iovec) { .iov_base = e->seg[i].buf, .iov_len = e->seg[i].len };
+    len += e->seg[i].len;
+  }
+  if (op != BLKIO_FLUSH && !blkimg_inside(&img, off, len)) return false;
+
+  nr_free --;
+  s->head = e->head;
+  s->status = e->seg[n - 1].buf;
+  s->len = (op == BLKIO_READ ? len : 0) + 1;
+  s->gen = gen;
+  s->io = (BlkIOReq) { .op = op, .fd = img.fd, .off = off, .iov = s->iov, .iovcnt = n - 2 };
+  blkio_submit(&ioq, &s->io);
+  return true;
+}
+
+// called in the CPU thread after some requests are completed
+static void blk_complete() {
+  bool pushed = false;
+  for (BlkIOReq *r = blkio_reap(&ioq); r != NULL; r = r->next) {
+    BlkSlot *s = (BlkSlot *)r;
+    free_slot[nr_free ++] = s - slot;
+    if (s->gen != gen) continue;
+    bool ok = (r->ret == (r->op == BLKIO_FLUSH ? 0 : s->len - 1));
+    *s->status = (ok ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR);
+    elem.head = s->head;
+    virtq_push(&dev, 0, &elem, (ok ? s->len : 1));
+    pushed = true;
+  }
+  if (pushed) virtq_notify(&dev, 0);
+}
+
+/* Wait for the requests in flight, so that none of them touches the memory
+ * of the guest after the reset, and the new driver gets all the slots. */
+static void blk_reset(VirtioDev *d) {
+  gen ++;
+  while (true) {
+    blk_complete(); // the completions of the old generation are dropped
+    if (nr_free == VIRTQ_MAX_NUM) break;
+    sched_yield();
+  }
+}
+#endif
+
+/* A request is a device-readable header, followed by the data buffers, and
+ * a one-byte device-writable status at last. Return the number of bytes
+ * written to the chain, or IN_FLIGHT if the request is completed later. */
+static uint32_t blk_request(VirtqElem *e) {
+  int n = e->nr_seg;
+  if (n < 2 || e->seg[0].len < sizeof(VirtioBlkReqHdr) || e->seg[n - 1].len < 1 ||
+      !e->seg[n - 1].write) {
+    Log("invalid virtio-blk request");
+    return 0;
+  }
+  VirtioBlkReqHdr *hdr = (VirtioBlkReqHdr *)e->seg[0].buf;
+  uint8_t *status = e->seg[n - 1].buf;
+
+  size_t off = hdr->sector * SECTOR_SIZE;
+  uint32_t written = 1;
+  *status = VIRTIO_BLK_S_OK;
+  switch (hdr->type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+      bool is_write = (hdr->type == VIRTIO_BLK_T_OUT);
+#ifdef CONFIG_BLKIO_ASYNC
+      if (blk_submit(e, (is_write ? BLKIO_WRITE : BLKIO_READ), off)) return IN_FLIGHT;
+#endif
+      for (int i = 1; i < n - 1; i ++) {
+        uint32_t len = e->seg[i].len;
+        if (e->seg[i].write == is_write || !blkimg_inside(&img, off, len)) {
+          *status = VIRTIO_BLK_S_IOERR;
+          break;
+        }
+        if (is_write) blkimg_write(&img, off, e->seg[i].buf, len);
+        else { blkimg_read(&img, off, e->seg[i].buf, len); written += len; }
+        off += len;
+      }
+      break;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+#ifdef CONFIG_BLKIO_ASYNC
+      if (blk_submit(e, BLKIO_FLUSH, 0)) return IN_FLIGHT;
+#endif
+      break; // the image is mapped shared, the host page cache keeps it
+    case VIRTIO_BLK_T_GET_ID:
+      if (n > 2 && e->seg[1].write) {
+        uint32_t len = (e->seg[1].len < 20 ? e->seg[1].len : 20);
+        strncpy((char *)e->seg[1].buf, "nemu-virtio-blk", len);
+        written += len;
+      }
+      break;
+    default: *status = VIRTIO_BLK_S_UNSUPP; break;
+  }
+  return written;
+}
+
+static void blk_notify(VirtioDev *d, int q) {
+  while (virtq_pop(d, q, &elem)) {
+    uint32_t len = blk_request(&elem);
+    if (len != IN_FLIGHT) virtq_push(d, q, &elem, len);
+  }
+  virtq_notify(d, q);
+}
+
+void init_virtio_blk() {
+  if (!blkimg_open(&img, CONFIG_VIRTIO_BLK_IMG_PATH)) {
+    if (CONFIG_VIRTIO_BLK_IMG_PATH[0] != '\0') {
+      Log("Can not find virtio-blk image: %s", CONFIG_VIRTIO_BLK_IMG_PATH);
+    }
+    return;
+  }
+  config.capacity = img.size / SECTOR_SIZE;
+  dev = (VirtioDev) { .name = "virtio-blk", .device_id = VIRTIO_ID_BLOCK, .nr_queue = 1,
+    .irq = IRQ_VIRTIO_BLK, .config = &config, .config_len = sizeof(config), .notify = blk_notify,
+    .reset = MUXDEF(CONFIG_BLKIO_ASYNC, blk_reset, NULL) };
+#ifdef CONFIG_BLKIO_ASYNC
+  for (int i = 0; i < VIRTQ_MAX_NUM; i ++) free_slot[nr_free ++] = i;
+  blkio_queue_init(&ioq, add_event_handle(blk_complete));
+#endif
+  virtio_mmio_init(&dev, CONFIG_VIRTIO_BLK_MMIO);
+  Log("virtio-blk image %s, %" PRIu64 " sectors", img.path, config.capacity);
+}
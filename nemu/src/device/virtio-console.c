@@ -0,0 +1,96 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/virtio.h>
+#include <device/alarm.h>
+#include <device/intr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+
+/* A single-port console. Output is written to the host stderr, like the
+ * serial. Input is read without blocking from a named pipe or stdin
+ * straight into the receive buffers posted by the guest. */
+
+#define VIRTIO_ID_CONSOLE 3
+enum { RXQ, TXQ };
+
+static VirtioDev dev = {};
+static VirtqElem elem;
+static int rx_fd = -1;
+
+static void console_tx(VirtioDev *d) {
+  while (virtq_pop(d, TXQ, &elem)) {
+    struct iovec iov[VIRTQ_MAX_NUM];
+    int n = 0;
+    for (int i = 0; i < elem.nr_seg; i ++) {
+      if (elem.seg[i].write) continue;
+      iov[n ++] = (struct iovec) { .iov_base = elem.seg[i].buf, .iov_len = elem.seg[i].len };
+    }
+    if (n > 0 && writev(STDERR_FILENO, iov, n) < 0) Log("virtio-console: output failed");
+    virtq_push(d, TXQ, &elem, 0);
+  }
+  virtq_notify(d, TXQ);
+}
+
+static void console_rx() {
+  if (rx_fd < 0 || !virtq_ready(&dev, RXQ)) return;
+  int pending = 0;
+  if (ioctl(rx_fd, FIONREAD, &pending) != 0) return;
+  while (pending > 0 && virtq_pop(&dev, RXQ, &elem)) {
+    uint32_t len = 0;
+    if (elem.nr_seg > 0 && elem.seg[0].write) {
+      ssize_t ret = read(rx_fd, elem.seg[0].buf, (elem.seg[0].len < (uint32_t)pending ? elem.seg[0].len : pending));
+      if (ret > 0) { len = ret; pending -= ret; }
+    }
+    virtq_push(&dev, RXQ, &elem, len);
+  }
+  virtq_notify(&dev, RXQ);
+}
+
+static void console_notify(VirtioDev *d, int q) {
+  if (q == TXQ) console_tx(d);
+  else console_rx();
+}
+
+static void init_rx() {
+  const char *path = CONFIG_VIRTIO_CONSOLE_INPUT_PATH;
+  if (path[0] == '\0') return;
+  if (strcmp(path, "-") == 0) {
+    rx_fd = dup(STDIN_FILENO);
+  } else {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+      int ret = mkfifo(path, 0666);
+      Assert(ret == 0, "Can not create %s", path);
+    }
+    // open with O_RDWR so that reading a FIFO without writers does not get EOF
+    rx_fd = open(path, O_RDWR);
+  }
+  Assert(rx_fd >= 0, "Can not open %s for virtio-console input", path);
+  fcntl(rx_fd, F_SETFL, fcntl(rx_fd, F_GETFL) | O_NONBLOCK);
+  add_alarm_handle(console_rx);
+  Log("virtio-console input from %s", path);
+}
+
+void init_virtio_console() {
+  dev = (VirtioDev) { .name = "virtio-console", .device_id = VIRTIO_ID_CONSOLE, .nr_queue = 2,
+    .irq = IRQ_VIRTIO_CONSOLE, .notify = console_notify };
+  virtio_mmio_init(&dev, CONFIG_VIRTIO_CONSOLE_MMIO);
+  init_rx();
+}
@@ -0,0 +1,234 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/map.h>
+#include <device/intr.h>
+#include <device/virtio.h>
+#include <memory/paddr.h>
+
+/* The virtio-mmio transport (version 2). The rings are accessed directly in
+ * guest memory. Both the guest and the backends run in the CPU thread, so no
+ * memory barrier is needed between them. A notification handles all the
+ * available chains of a queue before the used index is published and the
+ * guest is interrupted once. */
+
+#define VIRTIO_MAGIC  0x74726976 // "virt"
+#define VIRTIO_VENDOR 0x554d454e // "NEMU"
+
+enum {
+  REG_MAGIC               = 0x000,
+  REG_VERSION             = 0x004,
+  REG_DEVICE_ID           = 0x008,
+  REG_VENDOR_ID           = 0x00c,
+  REG_DEVICE_FEATURES     = 0x010,
+  REG_DEVICE_FEATURES_SEL = 0x014,
+  REG_DRIVER_FEATURES     = 0x020,
+  REG_DRIVER_FEATURES_SEL = 0x024,
+  REG_QUEUE_SEL           = 0x030,
+  REG_QUEUE_NUM_MAX       = 0x034,
+  REG_QUEUE_NUM           = 0x038,
+  REG_QUEUE_READY         = 0x044,
+  REG_QUEUE_NOTIFY        = 0x050,
+  REG_INTERRUPT_STATUS    = 0x060,
+  REG_INTERRUPT_ACK       = 0x064,
+  REG_STATUS              = 0x070,
+  REG_QUEUE_DESC_LOW      = 0x080,
+  REG_QUEUE_DESC_HIGH     = 0x084,
+  REG_QUEUE_DRIVER_LOW    = 0x090,
+  REG_QUEUE_DRIVER_HIGH   = 0x094,
+  REG_QUEUE_DEVICE_LOW    = 0x0a0,
+  REG_QUEUE_DEVICE_HIGH   = 0x0a4,
+  REG_CONFIG_GENERATION   = 0x0fc,
+  REG_CONFIG              = 0x100,
+};
+
+#define VIRTIO_MMIO_SIZE 0x200
+#define VIRTIO_STATUS_NEEDS_RESET 0x40
+#define VIRTIO_ISR_USED 1
+
+// the handlers of a map do not know the map, so each device gets its own pair
+#define MAX_VIRTIO_DEV 4
+static VirtioDev *devs[MAX_VIRTIO_DEV] = {};
+static int nr_dev = 0;
+
+// check in 64 bits, since in_pmem() would truncate the address to paddr_t
+static void* guest_range(uint64_t addr, uint64_t len) {
+  if (len == 0 || addr < CONFIG_MBASE || len > CONFIG_MSIZE ||
+      addr - CONFIG_MBASE > CONFIG_MSIZE - len) return NULL;
+  return guest_to_host(addr);
+}
+
+static void set_lo(uint64_t *p, uint32_t v) { *p = (*p & ~0xffffffffull) | v; }
+static void set_hi(uint64_t *p, uint32_t v) { *p = (*p & 0xffffffffull) | ((uint64_t)v << 32); }
+
+static void virtio_fail(VirtioDev *dev, const char *msg) {
+  Log("%s: %s", dev->name, msg);
+  dev->status |= VIRTIO_STATUS_NEEDS_RESET;
+}
+
+static void virtio_reset(VirtioDev *dev) {
+  dev->driver_features = 0;
+  dev->features_sel = dev->driver_features_sel = dev->queue_sel = 0;
+  dev->status = 0;
+  dev->isr = 0;
+  memset(dev->vq, 0, sizeof(dev->vq));
+  if (dev->reset) dev->reset(dev);
+}
+
+static void queue_set_ready(VirtioDev *dev, Virtq *vq, uint32_t ready) {
+  vq->ready = 0;
+  if (!ready) return;
+  vq->desc  = guest_range(vq->desc_addr, sizeof(VirtqDesc) * vq->num);
+  vq->avail = guest_range(vq->avail_addr, sizeof(VirtqAvail) + sizeof(uint16_t) * (vq->num + 1));
+  vq->used  = guest_range(vq->used_addr, sizeof(VirtqUsed) + 8 * vq->num + sizeof(uint16_t));
+  if (vq->num == 0 || (vq->num & (vq->num - 1)) || vq->desc == NULL ||
+      vq->avail == NULL || vq->used == NULL) {
+    virtio_fail(dev, "invalid virtqueue");
+    return;
+  }
+  vq->last_avail = vq->avail->idx;
+  vq->used_idx = vq->used->idx;
+  vq->ready = 1;
+}
+
+bool virtq_pop(VirtioDev *dev, int q, VirtqElem *elem) {
+  Virtq *vq = &dev->vq[q];
+  if (!vq->ready || vq->last_avail == vq->avail->idx) return false;
+  uint16_t head = vq->avail->ring[vq->last_avail % vq->num];
+  vq->last_avail ++;
+
+  elem->head = head;
+  elem->nr_seg = 0;
+  uint16_t i = head;
+  while (true) {
+    if (i >= vq->num || elem->nr_seg == vq->num) {
+      virtio_fail(dev, "invalid descriptor chain");
+      return false;
+    }
+    VirtqDesc *d = &vq->desc[i];
+    uint8_t *buf = guest_range(d->addr, d->len);
+    if (buf == NULL && d->len != 0) {
+      virtio_fail(dev, "buffer out of guest memory");
+      return false;
+    }
+    elem->seg[elem->nr_seg].buf = buf;
+    elem->seg[elem->nr_seg].len = d->len;
+    elem->seg[elem->nr_seg].write = d->flags & VIRTQ_DESC_F_WRITE;
+    elem->nr_seg ++;
+    if (!(d->flags & VIRTQ_DESC_F_NEXT)) break;
+    i = d->next;
+  }
+  return true;
+}
+
+void virtq_push(VirtioDev *dev, int q, VirtqElem *elem, uint32_t len) {
+  Virtq *vq = &dev->vq[q];
+  uint16_t idx = vq->used_idx % vq->num;
+  vq->used->ring[idx].id = elem->head;
+  vq->used->ring[idx].len = len;
+  vq->used_idx ++;
+}
+
+void virtq_notify(VirtioDev *dev, int q) {
+  Virtq *vq = &dev->vq[q];
+  if (vq->used->idx == vq->used_idx) return;
+  vq->used->idx = vq->used_idx;
+  if (!(vq->avail->flags & VIRTQ_AVAIL_F_NO_INTERRUPT)) {
+    dev->isr |= VIRTIO_ISR_USED;
+    dev_raise_intr(dev->irq);
+  }
+}
+
+static word_t virtio_reg_read(VirtioDev *dev, uint32_t offset, int len) {
+  if (offset >= REG_CONFIG) {
+    uint32_t off = offset - REG_CONFIG;
+    if (off + len > dev->config_len) return 0;
+    word_t ret = 0;
+    memcpy(&ret, (uint8_t *)dev->config + off, len);
+    return ret;
+  }
+  Assert(len == 4, "%s: %d-byte access to register 0x%x", dev->name, len, offset);
+  Virtq *vq = &dev->vq[dev->queue_sel];
+  switch (offset) {
+    case REG_MAGIC:           return VIRTIO_MAGIC;
+    case REG_VERSION:         return 2;
+    case REG_DEVICE_ID:       return dev->device_id;
+    case REG_VENDOR_ID:       return VIRTIO_VENDOR;
+    case REG_DEVICE_FEATURES: return (dev->features_sel < 2 ? dev->features >> (32 * dev->features_sel) : 0);
+    case REG_QUEUE_NUM_MAX:   return (dev->queue_sel < dev->nr_queue ? VIRTQ_MAX_NUM : 0);
+    case REG_QUEUE_READY:     return vq->ready;
+    case REG_INTERRUPT_STATUS: return dev->isr;
+    case REG_STATUS:          return dev->status;
+    case REG_CONFIG_GENERATION: return 0;
+    default: return 0;
+  }
+}
+
+static void virtio_reg_write(VirtioDev *dev, uint32_t offset, int len, word_t data) {
+  if (offset >= REG_CONFIG) return; // the configuration of the backends is read-only
+  Assert(len == 4, "%s: %d-byte access to register 0x%x", dev->name, len, offset);
+  Virtq *vq = &dev->vq[dev->queue_sel];
+  switch (offset) {
+    case REG_DEVICE_FEATURES_SEL: dev->features_sel = data; break;
+    case REG_DRIVER_FEATURES_SEL: dev->driver_features_sel = data; break;
+    case REG_DRIVER_FEATURES:
+      if (dev->driver_features_sel == 0) set_lo(&dev->driver_features, data);
+      else if (dev->driver_features_sel == 1) set_hi(&dev->driver_features, data);
+      break;
+    case REG_QUEUE_SEL: if (data < VIRTIO_MAX_QUEUE) dev->queue_sel = data; break;
+    case REG_QUEUE_NUM: vq->num = (data <= VIRTQ_MAX_NUM ? data : 0); break;
+    case REG_QUEUE_READY: queue_set_ready(dev, vq, data & 1); break;
+    case REG_QUEUE_NOTIFY:
+      if (data < dev->nr_queue && dev->vq[data].ready) dev->notify(dev, data);
+      break;
+    case REG_INTERRUPT_ACK: dev->isr &= ~data; break;
+    case REG_STATUS:
+      if (data == 0) virtio_reset(dev);
+      else dev->status = data;
+      break;
+    case REG_QUEUE_DESC_LOW:    set_lo(&vq->desc_addr, data); break;
+    case REG_QUEUE_DESC_HIGH:   set_hi(&vq->desc_addr, data); break;
+    case REG_QUEUE_DRIVER_LOW:  set_lo(&vq->avail_addr, data); break;
+    case REG_QUEUE_DRIVER_HIGH: set_hi(&vq->avail_addr, data); break;
+    case REG_QUEUE_DEVICE_LOW:  set_lo(&vq->used_addr, data); break;
+    case REG_QUEUE_DEVICE_HIGH: set_hi(&vq->used_addr, data); break;
+    default: break;
+  }
+}
+
+#define VIRTIO_HANDLERS(i) \
+  static word_t concat(virtio_read, i)(uint32_t offset, int len) { \
+    return virtio_reg_read(devs[i], offset, len); \
+  } \
+  static void concat(virtio_write, i)(uint32_t offset, int len, word_t data) { \
+    virtio_reg_write(devs[i], offset, len, data); \
+  }
+
+VIRTIO_HANDLERS(0) VIRTIO_HANDLERS(1) VIRTIO_HANDLERS(2) VIRTIO_HANDLERS(3)
+static const io_read_t virtio_read[MAX_VIRTIO_DEV] = { virtio_read0, virtio_read1, virtio_read2, virtio_read3 };
+static const io_write_t virtio_write[MAX_VIRTIO_DEV] = { virtio_write0, virtio_write1, virtio_write2, virtio_write3 };
+
+void virtio_mmio_init(VirtioDev *dev, paddr_t addr) {
+  Assert(nr_dev < MAX_VIRTIO_DEV, "too many virtio devices");
+  assert(dev->nr_queue <= VIRTIO_MAX_QUEUE);
+  dev->features |= 1ull << VIRTIO_F_VERSION_1;
+  virtio_reset(dev);
+  devs[nr_dev] = dev;
+  IOMap *map = add_mmio_map(dev->name, addr, new_space(VIRTIO_MMIO_SIZE), VIRTIO_MMIO_SIZE, NULL);
+  map->read = virtio_read[nr_dev];
+  map->write = virtio_write[nr_dev];
+  nr_dev ++;
+}
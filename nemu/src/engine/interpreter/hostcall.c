@@ -49,3 +49,239 @@ void invalid_inst(vaddr_t thispc) {
 
   set_nemu_state(NEMU_ABORT, thispc, -1);
 }
+
+#ifdef CONFIG_SEMIHOSTING
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/journal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* The semihosting calls of ARM, which are also used by RISC-V. `op` selects
+ * the call, and `args` points to its arguments in guest memory, each of them
+ * is a word. The vendor calls of NEMU take their arguments in `a1`-`a3`
+ * directly instead. The buffers are accessed directly in the host memory
+ * backing guest RAM, so a call fails with EFAULT if paging is on or if a
+ * buffer is not RAM. */
+
+enum {
+  SYS_OPEN = 0x01, SYS_CLOSE = 0x02, SYS_WRITEC = 0x03, SYS_WRITE0 = 0x04,
+  SYS_WRITE = 0x05, SYS_READ = 0x06, SYS_READC = 0x07, SYS_ISERROR = 0x08,
+  SYS_ISTTY = 0x09, SYS_SEEK = 0x0a, SYS_FLEN = 0x0c, SYS_REMOVE = 0x0e,
+  SYS_CLOCK = 0x10, SYS_TIME = 0x11, SYS_ERRNO = 0x13, SYS_EXIT = 0x18,
+  SYS_ELAPSED = 0x30, SYS_TICKFREQ = 0x31,
+};
+
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+/* the vendor calls, which run the string functions of the guest on the host,
+ * if a range is not RAM, MEMCPY, MEMMOVE and MEMSET return 0 instead of the
+ * destination and MEMCMP returns 2 instead of the sign of the difference,
+ * so that the guest can do it by itself */
+enum { SYS_NEMU_MEMCPY = 0x100, SYS_NEMU_MEMMOVE, SYS_NEMU_MEMSET, SYS_NEMU_MEMCMP };
+
+// host fd + 1 of each handle, 0 if the handle is free; handle 0 is never used
+#define MAX_HANDLE 64
+static int handle[MAX_HANDLE] = {};
+static int host_errno = 0;
+
+static inline word_t arg(vaddr_t args, int i) {
+  return vaddr_read(args + i * sizeof(word_t), sizeof(word_t));
+}
+
+static inline int handle_fd(word_t h) {
+  return (h < MAX_HANDLE ? handle[h] - 1 : -1);
+}
+
+static sword_t new_handle(int fd) {
+  // SYS_OPEN returns a nonzero handle on success
+  for (int i = 1; i < MAX_HANDLE; i ++) {
+    if (handle[i] == 0) { handle[i] = fd + 1; return i; }
+  }
+  if (fd > STDERR_FILENO) close(fd);
+  host_errno = EMFILE;
+  return -1;
+}
+
+/* return the host memory backing [addr, addr + len) in guest RAM, or NULL
+ * if paging is on or the range is not all RAM (writable RAM for writes) */
+static uint8_t* guest_ram(word_t addr, word_t len, int type) {
+  uint8_t *host = NULL;
+  if (isa_mmu_check(addr, len, type) == MMU_DIRECT && addr == (paddr_t)addr) {
+    host = paddr_span(addr, len);
+    if (host != NULL && type == MEM_TYPE_WRITE &&
+        find_mem_region(addr, addr + len - 1)->readonly) host = NULL;
+  }
+  if (host == NULL) host_errno = EFAULT;
+  return host;
+}
+
+// the REF does not run the call, so it gets what the call wrote to guest memory
+static void sync_ref(paddr_t addr, void *host, word_t len) {
+  IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(addr, host, len, DIFFTEST_TO_REF));
+}
+
+// return a copy of the file name, or NULL if it is too long or not in RAM
+static char* guest_string(word_t addr, word_t len) {
+  if (len > PATH_MAX) { host_errno = ENAMETOOLONG; return NULL; }
+  uint8_t *host = (len == 0 ? (uint8_t *)"" : guest_ram(addr, len, MEM_TYPE_READ));
+  if (host == NULL) return NULL;
+  char *str = malloc(len + 1);
+  assert(str);
+  memcpy(str, host, len);
+  str[len] = '\0';
+  return str;
+}
+
+static sword_t sys_open(word_t name, word_t mode, word_t len) {
+  static const int flags[] = {
+    O_RDONLY, O_RDONLY, O_RDWR, O_RDWR,
+    O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC,
+    O_RDWR | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC,
+    O_WRONLY | O_CREAT | O_APPEND, O_WRONLY | O_CREAT | O_APPEND,
+    O_RDWR | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND,
+  };
+  if (mode >= ARRLEN(flags)) { host_errno = EINVAL; return -1; }
+  char *path = guest_string(name, len);
+  if (path == NULL) return -1;
+  int fd;
+  if (strcmp(path, ":tt") == 0) {
+    // the console, stdin for reading, stdout for writing and stderr for appending
+    fd = (mode < 4 ? STDIN_FILENO : (mode < 8 ? STDOUT_FILENO : STDERR_FILENO));
+  } else {
+    fd = open(path, flags[mode] | O_CLOEXEC, 0644);
+    if (fd < 0) host_errno = errno;
+  }
+  free(path);
+  return (fd < 0 ? -1 : new_handle(fd));
+}
+
+// the console is an input of the guest, so it is read through the journal
+static ssize_t file_read(int fd, void *buf, size_t len) {
+  if (fd == STDIN_FILENO) return MUXDEF(CONFIG_JOURNAL, journal_read, read)(fd, buf, len);
+  return read(fd, buf, len);
+}
+
+/* transfer between the file and [addr, addr + len) in guest RAM, return
+ * the number of bytes not transferred */
+static word_t sys_rw(int fd, word_t addr, word_t len, bool is_read) {
+  if (fd < 0) { host_errno = EBADF; return len; }
+  if (len == 0) return 0;
+  uint8_t *host = guest_ram(addr, len, (is_read ? MEM_TYPE_WRITE : MEM_TYPE_READ));
+  if (host == NULL) return len;
+  ssize_t ret = (is_read ? file_read(fd, host, len) : write(fd, host, len));
+  if (ret < 0) { host_errno = errno; return len; }
+  if (is_read && ret > 0) sync_ref(addr, host, ret);
+  return len - ret;
+}
+
+static word_t mem_move(word_t dst, word_t src, word_t n) {
+  uint8_t *d = guest_ram(dst, n, MEM_TYPE_WRITE), *s = guest_ram(src, n, MEM_TYPE_READ);
+  if (d == NULL || s == NULL) return 0;
+  memmove(d, s, n);
+  sync_ref(dst, d, n);
+  return dst;
+}
+
+static word_t mem_set(word_t dst, int c, word_t n) {
+  uint8_t *d = guest_ram(dst, n, MEM_TYPE_WRITE);
+  if (d == NULL) return 0;
+  memset(d, c, n);
+  sync_ref(dst, d, n);
+  return dst;
+}
+
+static word_t mem_cmp(word_t a, word_t b, word_t n) {
+  uint8_t *pa = guest_ram(a, n, MEM_TYPE_READ), *pb = guest_ram(b, n, MEM_TYPE_READ);
+  if (pa == NULL || pb == NULL) return 2;
+  int ret = memcmp(pa, pb, n);
+  return (sword_t)(ret > 0) - (ret < 0);
+}
+
+word_t semihost(vaddr_t pc, word_t op, word_t args, word_t a2, word_t a3) {
+  difftest_skip_ref();
+  switch (op) {
+    case SYS_NEMU_MEMCPY:
+    case SYS_NEMU_MEMMOVE: return (a3 == 0 ? args : mem_move(args, a2, a3));
+    case SYS_NEMU_MEMSET:  return (a3 == 0 ? args : mem_set(args, a2, a3));
+    case SYS_NEMU_MEMCMP:  return (a3 == 0 ? 0 : mem_cmp(args, a2, a3));
+
+    case SYS_OPEN: return sys_open(arg(args, 0), arg(args, 1), arg(args, 2));
+    case SYS_CLOSE: {
+      word_t h = arg(args, 0);
+      int fd = handle_fd(h);
+      if (fd < 0) { host_errno = EBADF; return -1; }
+      handle[h] = 0;
+      if (fd > STDERR_FILENO && close(fd) != 0) { host_errno = errno; return -1; }
+      return 0;
+    }
+    case SYS_WRITEC: {
+      uint8_t c = vaddr_read(args, 1);
+      if (write(STDOUT_FILENO, &c, 1) != 1) host_errno = errno;
+      return 0;
+    }
+    case SYS_WRITE0: {
+      size_t len = 0;
+      while (vaddr_read(args + len, 1) != 0) len ++;
+      sys_rw(STDOUT_FILENO, args, len, false);
+      return 0;
+    }
+    case SYS_WRITE: return sys_rw(handle_fd(arg(args, 0)), arg(args, 1), arg(args, 2), false);
+    case SYS_READ:  return sys_rw(handle_fd(arg(args, 0)), arg(args, 1), arg(args, 2), true);
+    case SYS_READC: {
+      uint8_t c;
+      return (file_read(STDIN_FILENO, &c, 1) == 1 ? c : (word_t)-1);
+    }
+    case SYS_ISERROR: return (sword_t)arg(args, 0) < 0;
+    case SYS_ISTTY: {
+      int fd = handle_fd(arg(args, 0));
+      return fd >= 0 && isatty(fd);
+    }
+    case SYS_SEEK: {
+      int fd = handle_fd(arg(args, 0));
+      if (fd < 0 || lseek(fd, arg(args, 1), SEEK_SET) < 0) { host_errno = (fd < 0 ? EBADF : errno); return -1; }
+      return 0;
+    }
+    case SYS_FLEN: {
+      int fd = handle_fd(arg(args, 0));
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0) { host_errno = (fd < 0 ? EBADF : errno); return -1; }
+      return st.st_size;
+    }
+    case SYS_REMOVE: {
+      char *path = guest_string(arg(args, 0), arg(args, 1));
+      if (path == NULL) return -1;
+      int ret = unlink(path);
+      if (ret != 0) host_errno = errno;
+      free(path);
+      return (ret == 0 ? 0 : -1);
+    }
+    case SYS_CLOCK: return JOURNAL(J_TIME, get_time()) / 10000; // in centiseconds
+    case SYS_TIME: return JOURNAL(J_VALUE, time(NULL));
+    case SYS_ELAPSED: {
+      uint64_t us = JOURNAL(J_TIME, get_time());
+      uint8_t *host = guest_ram(args, sizeof(us), MEM_TYPE_WRITE);
+      if (host == NULL) return -1;
+      memcpy(host, &us, sizeof(us));
+      sync_ref(args, host, sizeof(us));
+      return 0;
+    }
+    case SYS_TICKFREQ: return 1000000;
+    case SYS_ERRNO: return host_errno;
+    case SYS_EXIT: {
+      // the reason and the exit code are in a block on 64-bit, and there is only the reason on 32-bit
+      word_t reason = MUXDEF(CONFIG_ISA64, arg(args, 0), args);
+      int code = MUXDEF(CONFIG_ISA64, arg(args, 1), 0);
+      set_nemu_state(NEMU_END, pc, (reason == ADP_STOPPED_APPLICATION_EXIT ? code : 1));
+      return 0;
+    }
+    default:
+      Log("unsupported semihosting call 0x%x at pc = " FMT_WORD, (int)op, pc);
+      return -1;
+  }
+}
+#endif
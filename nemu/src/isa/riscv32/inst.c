@@ -17,11 +17,70 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
+enum { CSR_WRITE, CSR_SET, CSR_CLEAR };
+
+// write, set or clear the bits of `val` in CSR `no`, and return its old value
+static word_t csr_access(vaddr_t pc, word_t no, word_t val, int op) {
+  word_t *p;
+  switch (no & 0xfff) {
+    case CSR_MSTATUS:  p = &cpu.csr.mstatus; break;
+    case CSR_MIE:      p = &cpu.csr.mie; break;
+    case CSR_MTVEC:    p = &cpu.csr.mtvec; break;
+    case CSR_MSCRATCH: p = &cpu.csr.mscratch; break;
+    case CSR_MEPC:     p = &cpu.csr.mepc; break;
+    case CSR_MCAUSE:   p = &cpu.csr.mcause; break;
+    case CSR_MIP:      return cpu.csr.mip; // driven by the interrupt controllers
+    case CSR_MHARTID:  return 0;
+    default: INV(pc); return 0;
+  }
+  word_t old = *p;
+  switch (op) {
+    case CSR_WRITE: *p = val; break;
+    case CSR_SET:   *p = old | val; break;
+    case CSR_CLEAR: *p = old & ~val; break;
+  }
+  return old;
+}
+
+static vaddr_t mret() {
+  word_t s = cpu.csr.mstatus;
+  s = (s & ~MSTATUS_MIE) | ((s & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  cpu.csr.mstatus = s | MSTATUS_MPIE;
+  return cpu.csr.mepc;
+}
+
+#ifdef CONFIG_SEMIHOSTING
+// the instruction at `addr` is only peeked if it is in memory, so that a trap
+// at the edge of a region does not access anything out of it
+static bool in_memory(paddr_t addr) {
+  const MemRegion *r = find_mem_region(addr, addr + 3);
+  return r != NULL && r->low <= addr && addr + 3 <= r->high;
+}
+
+// a semihosting call is an ebreak between `slli x0, x0, 0x1f` and `srai x0, x0, 7`
+static bool is_semihost_call(vaddr_t pc) {
+  return in_memory(pc - 4) && in_memory(pc + 4) &&
+    vaddr_ifetch(pc - 4, 4) == 0x01f01013 && vaddr_ifetch(pc + 4, 4) == 0x40705013;
+}
+#endif
+
+static void ebreak(vaddr_t pc) {
+#ifdef CONFIG_SEMIHOSTING
+  if (is_semihost_call(pc)) {
+    // $a0 is the call, and $a1 points to the arguments, or $a1-$a3 are the arguments
+    R(10) = semihost(pc, R(10), R(11), R(12), R(13));
+    return;
+  }
+#endif
+  NEMUTRAP(pc, R(10)); // R(10) is $a0
+}
+
 enum {
   TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
@@ -61,7 +120,15 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(rd) = Mr(src1 + imm, 4));
   INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
 
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0000000 ????? ????? 001 ????? 00100 11", slli   , I, R(rd) = src1 << BITS(imm, 4, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai   , I, R(rd) = (sword_t)src1 >> BITS(imm, 4, 0));
+
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, R(rd) = csr_access(s->pc, imm, src1, CSR_WRITE));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, R(rd) = csr_access(s->pc, imm, src1, CSR_SET));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, R(rd) = csr_access(s->pc, imm, src1, CSR_CLEAR));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = mret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, ); // a legal nop
+  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, ebreak(s->pc));
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
@@ -25,6 +25,16 @@ static inline int check_reg_idx(int idx) {
 
 #define gpr(idx) cpu.gpr[check_reg_idx(idx)]
 
+enum {
+  CSR_MSTATUS = 0x300, CSR_MIE = 0x304, CSR_MTVEC = 0x305,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MIP = 0x344,
+  CSR_MHARTID = 0xf14,
+};
+
+#define MSTATUS_MIE  (1 << 3)
+#define MSTATUS_MPIE (1 << 7)
+#define MSTATUS_MPP  (3 << 11)
+
 static inline const char* reg_name(int idx, int width) {
   extern const char* regs[];
   return regs[check_reg_idx(idx)];
@@ -14,15 +14,34 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
+#include "../local-include/reg.h"
+
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+  cpu.csr.mcause = NO;
+  cpu.csr.mepc = epc;
+  word_t s = cpu.csr.mstatus;
+  s = (s & ~MSTATUS_MPIE) | ((s & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  cpu.csr.mstatus = (s & ~MSTATUS_MIE) | MSTATUS_MPP;
 
-  return 0;
+  word_t base = cpu.csr.mtvec & ~(word_t)3;
+  bool vectored = (cpu.csr.mtvec & 1) && (NO & INTR_BIT);
+  return (vectored ? base + 4 * (NO & ~INTR_BIT) : base);
 }
 
 word_t isa_query_intr() {
+  word_t pending = cpu.csr.mip & cpu.csr.mie;
+  if (likely(pending == 0) || !(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  // in the order of priority
+  if (pending & (1 << IRQ_MEI)) return INTR_BIT | IRQ_MEI;
+  if (pending & (1 << IRQ_MSI)) return INTR_BIT | IRQ_MSI;
+  if (pending & (1 << IRQ_MTI)) return INTR_BIT | IRQ_MTI;
   return INTR_EMPTY;
 }
+
+void isa_set_intr(int no, bool pending) {
+  if (pending) cpu.csr.mip |= (word_t)1 << no;
+  else cpu.csr.mip &= ~((word_t)1 << no);
+}
@@ -21,6 +21,10 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  // machine-mode CSRs, not compared by difftest
+  struct {
+    word_t mstatus, mie, mip, mtvec, mscratch, mepc, mcause;
+  } csr;
 } riscv64_CPU_state;
 
 // decode
@@ -0,0 +1,227 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/cachesim.h>
+
+typedef struct {
+  uint64_t tag;
+  uint64_t stamp; // last use for LRU, fill time for FIFO
+  bool valid;
+  bool dirty;
+} CacheLine;
+
+typedef struct Cache {
+  const char *name;
+  int nr_set, assoc, line_shift;
+  CacheLine *lines;
+  uint64_t hit, miss, writeback;
+  struct Cache *next;
+} Cache;
+
+enum { L1I, L1D, L2, NR_CACHE };
+static Cache caches[NR_CACHE] = {};
+
+typedef struct {
+  const char *name;
+  uint64_t access, l1_miss, l2_miss;
+} AccessStat;
+
+#define NR_REGION_STAT 16
+static AccessStat region_stat[NR_REGION_STAT] = {};
+static int nr_region_stat = 0;
+static uint64_t nr_uncached = 0;
+
+typedef struct {
+  vaddr_t pc;
+  AccessStat stat;
+} PCStat;
+
+static PCStat *pc_stat = NULL;
+static uint64_t pc_stat_size = 0, nr_pc_stat = 0;
+
+static uint64_t tick = 0;
+
+#ifdef CONFIG_CACHE_REPL_RANDOM
+static uint32_t random_way(int assoc) {
+  // xorshift, so that the result does not depend on the seed of rand()
+  static uint32_t x = 2463534242u;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return x % assoc;
+}
+#endif
+
+static void init_cache(Cache *c, const char *name, int size_kb, int assoc, int line, Cache *next) {
+  Assert(line > 0 && (line & (line - 1)) == 0, "line size of %s should be a power of 2", name);
+  int nr_line = size_kb * 1024 / line;
+  Assert(assoc > 0 && nr_line % assoc == 0, "%s can not be divided into %d ways", name, assoc);
+  int nr_set = nr_line / assoc;
+  Assert((nr_set & (nr_set - 1)) == 0, "number of sets in %s should be a power of 2", name);
+  *c = (Cache){ .name = name, .nr_set = nr_set, .assoc = assoc,
+    .line_shift = __builtin_ctz(line), .next = next };
+  c->lines = calloc(nr_line, sizeof(CacheLine));
+  assert(c->lines);
+  Log("%s: %d KB, %d-way, %d B/line", name, size_kb, assoc, line);
+}
+
+// return true on hit
+static bool cache_access(Cache *c, paddr_t addr, bool is_write) {
+  uint64_t tag = addr >> c->line_shift;
+  CacheLine *set = &c->lines[(tag & (c->nr_set - 1)) * c->assoc];
+  tick ++;
+
+  CacheLine *victim = NULL;
+  for (int i = 0; i < c->assoc; i ++) {
+    CacheLine *l = &set[i];
+    if (l->valid && l->tag == tag) {
+      c->hit ++;
+      IFDEF(CONFIG_CACHE_REPL_LRU, l->stamp = tick);
+      l->dirty |= is_write;
+      return true;
+    }
+    if (!l->valid) { if (victim == NULL || victim->valid) victim = l; }
+    else if (victim == NULL || (victim->valid && l->stamp < victim->stamp)) victim = l;
+  }
+
+  c->miss ++;
+  IFDEF(CONFIG_CACHE_REPL_RANDOM, if (victim->valid) victim = &set[random_way(c->assoc)]);
+  if (victim->valid && victim->dirty) c->writeback ++;
+  // the line is filled from the next level, write back is not modeled there
+  if (c->next) cache_access(c->next, addr, false);
+  *victim = (CacheLine){ .tag = tag, .stamp = tick, .valid = true, .dirty = is_write };
+  return false;
+}
+
+static AccessStat* region_of(paddr_t addr) {
+  static const MemRegion *last = NULL;
+  static AccessStat *last_stat = NULL;
+  if (last != NULL && addr >= last->low && addr <= last->high) return last_stat;
+
+  const MemRegion *r = find_mem_region(addr, addr);
+  if (r == NULL) return NULL;
+  last = r;
+  for (int i = 0; i < nr_region_stat; i ++) {
+    if (region_stat[i].name == r->name) return (last_stat = &region_stat[i]);
+  }
+  assert(nr_region_stat < NR_REGION_STAT);
+  region_stat[nr_region_stat] = (AccessStat){ .name = r->name };
+  return (last_stat = &region_stat[nr_region_stat ++]);
+}
+
+static PCStat* pc_of(vaddr_t pc);
+
+static void pc_stat_grow() {
+  PCStat *old = pc_stat;
+  uint64_t old_size = pc_stat_size;
+  pc_stat_size = (old_size == 0 ? 4096 : old_size * 2);
+  pc_stat = calloc(pc_stat_size, sizeof(PCStat));
+  assert(pc_stat);
+  nr_pc_stat = 0;
+  for (uint64_t i = 0; i < old_size; i ++) {
+    if (old[i].stat.access != 0) *pc_of(old[i].pc) = old[i];
+  }
+  free(old);
+}
+
+// open addressing, an empty slot has no access
+static PCStat* pc_of(vaddr_t pc) {
+  if ((nr_pc_stat + 1) * 4 > pc_stat_size * 3) pc_stat_grow();
+  uint64_t i = ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 20;
+  for (;; i ++) {
+    PCStat *p = &pc_stat[i & (pc_stat_size - 1)];
+    if (p->stat.access == 0) { p->pc = pc; nr_pc_stat ++; return p; }
+    if (p->pc == pc) return p;
+  }
+}
+
+void cachesim_access(paddr_t addr, int len, int type) {
+  AccessStat *rs = region_of(addr);
+  if (rs == NULL) { nr_uncached ++; return; } // MMIO is not cached
+
+  Cache *l1 = &caches[type == MEM_TYPE_IFETCH ? L1I : L1D];
+  bool is_write = (type == MEM_TYPE_WRITE);
+  uint64_t l2_miss = caches[L2].miss; // always 0 without L2
+  bool l1_hit = cache_access(l1, addr, is_write);
+  if (((addr + len - 1) >> l1->line_shift) != (addr >> l1->line_shift)) {
+    // crossing two lines
+    l1_hit &= cache_access(l1, addr + len - 1, is_write);
+  }
+  bool l2_miss_now = (caches[L2].miss != l2_miss);
+
+  PCStat *ps = pc_of(cpu.pc);
+  AccessStat *stat[] = { rs, &ps->stat };
+  for (int i = 0; i < ARRLEN(stat); i ++) {
+    stat[i]->access ++;
+    stat[i]->l1_miss += !l1_hit;
+    stat[i]->l2_miss += l2_miss_now;
+  }
+}
+
+void init_cachesim() {
+  Cache *l2 = NULL;
+#ifdef CONFIG_CACHE_L2
+  l2 = &caches[L2];
+  init_cache(l2, "L2", CONFIG_CACHE_L2_SIZE, CONFIG_CACHE_L2_ASSOC, CONFIG_CACHE_L2_LINE, NULL);
+#endif
+  init_cache(&caches[L1I], "L1I", CONFIG_CACHE_L1I_SIZE, CONFIG_CACHE_L1I_ASSOC, CONFIG_CACHE_L1I_LINE, l2);
+  init_cache(&caches[L1D], "L1D", CONFIG_CACHE_L1D_SIZE, CONFIG_CACHE_L1D_ASSOC, CONFIG_CACHE_L1D_LINE, l2);
+}
+
+static double rate(uint64_t part, uint64_t total) {
+  return (total == 0 ? 0 : part * 100.0 / total);
+}
+
+static int pc_stat_cmp(const void *a, const void *b) {
+  uint64_t x = ((const PCStat *)a)->stat.l1_miss, y = ((const PCStat *)b)->stat.l1_miss;
+  return (x < y) - (x > y);
+}
+
+void cachesim_report() {
+  for (int i = 0; i < NR_CACHE; i ++) {
+    Cache *c = &caches[i];
+    if (c->lines == NULL) continue;
+    Log("%-3s: access = %" PRIu64 ", miss = %" PRIu64 " (%.2f%%), write back = %" PRIu64,
+        c->name, c->hit + c->miss, c->miss, rate(c->miss, c->hit + c->miss), c->writeback);
+  }
+  Log("uncached (MMIO) accesses = %" PRIu64, nr_uncached);
+
+  for (int i = 0; i < nr_region_stat; i ++) {
+    AccessStat *s = &region_stat[i];
+    Log("region %-8s: access = %" PRIu64 ", L1 miss = %.2f%%, L2 miss = %.2f%%", s->name,
+        s->access, rate(s->l1_miss, s->access), rate(s->l2_miss, s->access));
+  }
+
+  // sort a copy of the hash table by L1 misses
+  PCStat *sorted = malloc(sizeof(PCStat) * (nr_pc_stat + 1));
+  assert(sorted);
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < pc_stat_size; i ++) {
+    if (pc_stat[i].stat.access != 0) sorted[n ++] = pc_stat[i];
+  }
+  qsort(sorted, n, sizeof(PCStat), pc_stat_cmp);
+
+  const char* elf_symbol(vaddr_t addr, vaddr_t *offset);
+  for (uint64_t i = 0; i < n && i < CONFIG_CACHE_REPORT_PC; i ++) {
+    PCStat *p = &sorted[i];
+    vaddr_t off = 0;
+    const char *sym = elf_symbol(p->pc, &off);
+    Log("pc = " FMT_WORD " <%s+0x%x>: access = %" PRIu64 ", L1 miss = %" PRIu64 " (%.2f%%), L2 miss = %" PRIu64,
+        p->pc, (sym ? sym : "?"), (uint32_t)off, p->stat.access, p->stat.l1_miss,
+        rate(p->stat.l1_miss, p->stat.access), p->stat.l2_miss);
+  }
+  free(sorted);
+}
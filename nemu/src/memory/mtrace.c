@@ -0,0 +1,104 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+#include <memory/mtrace.h>
+#include <pthread.h>
+
+/* Records are appended to the front buffer on the hot path. When it is full,
+ * it is handed to the writer thread and the back buffer takes its place, so
+ * the simulator only stalls if the writer falls a whole buffer behind. */
+
+#define NR_RECORD (CONFIG_MTRACE_BUF_SIZE * 1024 / sizeof(MTraceRecord))
+
+MTraceRecord *mtrace_buf_cur = NULL, *mtrace_buf_end = NULL;
+static MTraceRecord *buf[2];
+static int front = 0;
+
+static FILE *fp = NULL;
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static MTraceRecord *pending = NULL; // buffer being written, protected by `lock`
+static size_t pending_nr = 0;
+static uint64_t nr_record = 0;
+
+static void* writer_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (pending == NULL) pthread_cond_wait(&cond, &lock);
+    MTraceRecord *p = pending;
+    size_t n = pending_nr;
+    pthread_mutex_unlock(&lock);
+
+    size_t ret = fwrite(p, sizeof(MTraceRecord), n, fp);
+    Assert(ret == n, "Can not write memory trace to %s", CONFIG_MTRACE_FILE);
+    fflush(fp);
+
+    pthread_mutex_lock(&lock);
+    pending = NULL;
+    pthread_cond_broadcast(&cond);
+  }
+  return NULL;
+}
+
+// hand the records in the front buffer to the writer thread
+void mtrace_swap() {
+  MTraceRecord *p = buf[front];
+  size_t n = mtrace_buf_cur - p;
+  if (n == 0) return;
+  nr_record += n;
+
+  pthread_mutex_lock(&lock);
+  while (pending != NULL) pthread_cond_wait(&cond, &lock);
+  pending = p;
+  pending_nr = n;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+
+  front = !front;
+  mtrace_buf_cur = buf[front];
+  mtrace_buf_end = buf[front] + NR_RECORD;
+}
+
+/* write out all records and wait for the writer thread */
+void mtrace_flush() {
+  mtrace_swap();
+  pthread_mutex_lock(&lock);
+  while (pending != NULL) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+  Log("%" PRIu64 " memory access records are written to %s", nr_record, CONFIG_MTRACE_FILE);
+}
+
+void init_mtrace() {
+  fp = fopen(CONFIG_MTRACE_FILE, "wb");
+  Assert(fp, "Can not open '%s'", CONFIG_MTRACE_FILE);
+  MTraceHeader h = { .magic = MTRACE_MAGIC, .version = MTRACE_VERSION,
+    .record_size = sizeof(MTraceRecord) };
+  size_t nr = fwrite(&h, sizeof(h), 1, fp);
+  Assert(nr == 1, "Can not write memory trace to %s", CONFIG_MTRACE_FILE);
+
+  for (int i = 0; i < 2; i ++) {
+    buf[i] = malloc(NR_RECORD * sizeof(MTraceRecord));
+    assert(buf[i]);
+  }
+  mtrace_buf_cur = buf[front];
+  mtrace_buf_end = buf[front] + NR_RECORD;
+
+  int ret = pthread_create(&writer, NULL, writer_thread, NULL);
+  assert(ret == 0);
+  Log("Memory trace is written to %s", CONFIG_MTRACE_FILE);
+}
@@ -15,8 +15,12 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -24,8 +28,44 @@ static uint8_t *pmem = NULL;
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
-uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
-paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
+#define NR_REGION 16
+
+static MemRegion regions[NR_REGION] = {};
+static int nr_region = 0;
+
+// Every page in the 32-bit physical address space is mapped to the index of
+// its region plus one, and 0 means the page is not backed by memory. This
+// makes the dispatch O(1) no matter how many regions there are.
+static uint8_t region_table[1ul << (32 - PAGE_SHIFT)] = {};
+
+static inline MemRegion* region_of(paddr_t addr) {
+#ifdef PMEM64
+  if (unlikely(addr >> 32)) {
+    // not covered by the region table, it should be rare
+    for (int i = 0; i < nr_region; i ++) {
+      if (addr >= regions[i].low && addr <= regions[i].high) return &regions[i];
+    }
+    return NULL;
+  }
+#endif
+  int id = region_table[addr >> PAGE_SHIFT];
+  return (id == 0 ? NULL : &regions[id - 1]);
+}
+
+uint8_t* guest_to_host(paddr_t paddr) {
+  if (likely(in_pmem(paddr))) return pmem + paddr - CONFIG_MBASE;
+  MemRegion *r = region_of(paddr);
+  return (r == NULL ? NULL : r->host + (paddr - r->low));
+}
+
+paddr_t host_to_guest(uint8_t *haddr) {
+  for (int i = 0; i < nr_region; i ++) {
+    MemRegion *r = &regions[i];
+    if (haddr >= r->host && haddr - r->host <= r->high - r->low) return r->low + (haddr - r->host);
+  }
+  panic("host address %p is not in any memory region", haddr);
+  return 0;
+}
 
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
@@ -36,28 +76,129 @@ static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
 }
 
+static word_t region_read(MemRegion *r, paddr_t addr, int len) {
+  return host_read(r->host + (addr - r->low), len);
+}
+
+static void region_write(MemRegion *r, paddr_t addr, int len, word_t data) {
+  if (unlikely(r->readonly)) {
+    panic("address = " FMT_PADDR " is in read-only region %s [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
+        addr, r->name, r->low, r->high, cpu.pc);
+  }
+  host_write(r->host + (addr - r->low), len, data);
+}
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
+static uint8_t* alloc_region(size_t size) {
+#ifdef CONFIG_TARGET_AM
+  uint8_t *p = malloc(size);
+  assert(p);
+#else
+  uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(p != MAP_FAILED);
+#endif
+  return p;
+}
+
+#ifdef CONFIG_MEM_FLASH
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint8_t* map_flash(const char *img, size_t size) {
+  uint8_t *p = alloc_region(size);
+  if (img[0] == '\0') {
+    Log("No flash image is given, the flash is blank");
+    return p;
+  }
+  int fd = open(img, O_RDONLY);
+  Assert(fd >= 0, "Can not open flash image '%s'", img);
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  Assert(st.st_size <= size, "flash image '%s' is larger than the flash", img);
+  size_t len = ROUNDUP(st.st_size, PAGE_SIZE);
+  if (len > 0) {
+    // the rest of the flash remains anonymous zero pages
+    void *q = mmap(p, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    assert(q == p);
+  }
+  close(fd);
+  return p;
+}
+#endif
+
+const MemRegion* find_mem_region(paddr_t left, paddr_t right) {
+  for (int i = 0; i < nr_region; i ++) {
+    if (left <= regions[i].high && right >= regions[i].low) return &regions[i];
+  }
+  return NULL;
+}
+
+const MemRegion* add_mem_region(const char *name, paddr_t addr, size_t size,
+    uint8_t *host, bool readonly) {
+  assert(nr_region < NR_REGION);
+  Assert(size > 0 && (addr & PAGE_MASK) == 0 && (size & PAGE_MASK) == 0,
+      "memory region %s is not page aligned", name);
+  paddr_t left = addr, right = addr + size - 1;
+  const MemRegion *r = find_mem_region(left, right);
+  if (r != NULL) {
+    panic("memory region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped "
+        "with %s@[" FMT_PADDR ", " FMT_PADDR "]", name, left, right, r->name, r->low, r->high);
+  }
+
+  regions[nr_region] = (MemRegion){ .name = name, .low = left, .high = right,
+    .host = (host == NULL ? alloc_region(size) : host), .readonly = readonly };
+  nr_region ++;
+  for (uint64_t pg = left >> PAGE_SHIFT; pg <= (right >> PAGE_SHIFT) && pg < ARRLEN(region_table); pg ++) {
+    region_table[pg] = nr_region;
+  }
+
+  Log("%s memory area %s [" FMT_PADDR ", " FMT_PADDR "]",
+      (readonly ? "read-only" : "physical"), name, left, right);
+  return &regions[nr_region - 1];
+}
+
+#ifdef CONFIG_MEM_RANDOM
+static void randomize(uint8_t *host, size_t size) {
+  uint32_t *p = (uint32_t *)host;
+  size_t i;
+  for (i = 0; i < size / sizeof(p[0]); i ++) {
+    p[i] = rand();
+  }
+}
+#endif
+
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
 #endif
-#ifdef CONFIG_MEM_RANDOM
-  uint32_t *p = (uint32_t *)pmem;
-  int i;
-  for (i = 0; i < (int) (CONFIG_MSIZE / sizeof(p[0])); i ++) {
-    p[i] = rand();
-  }
+  IFDEF(CONFIG_MEM_RANDOM, randomize(pmem, CONFIG_MSIZE));
+  add_mem_region("pmem", PMEM_LEFT, CONFIG_MSIZE, pmem, false);
+
+#ifdef CONFIG_MEM_BOOTROM
+  add_mem_region("bootrom", CONFIG_BOOTROM_BASE, CONFIG_BOOTROM_SIZE, NULL, true);
+#endif
+#ifdef CONFIG_MEM_SRAM
+  const MemRegion *sram = add_mem_region("sram", CONFIG_SRAM_BASE, CONFIG_SRAM_SIZE, NULL, false);
+  IFDEF(CONFIG_MEM_RANDOM, randomize(sram->host, CONFIG_SRAM_SIZE));
+#endif
+#ifdef CONFIG_MEM_FLASH
+  add_mem_region("flash", CONFIG_FLASH_BASE, CONFIG_FLASH_SIZE,
+      map_flash(CONFIG_FLASH_IMG_PATH, CONFIG_FLASH_SIZE), true);
 #endif
-  Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
+  MemRegion *r = region_of(addr);
+  if (r != NULL) return region_read(r, addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
@@ -65,6 +206,111 @@ word_t paddr_read(paddr_t addr, int len) {
 
 void paddr_write(paddr_t addr, int len, word_t data) {
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  MemRegion *r = region_of(addr);
+  if (r != NULL) { region_write(r, addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+// return the length of the longest host-backed prefix of [addr, addr + len)
+static size_t host_span(paddr_t addr, size_t len, uint8_t **host) {
+  MemRegion *r = (likely(in_pmem(addr)) ? &regions[0] : region_of(addr));
+  if (r == NULL) return 0;
+  size_t avail = (size_t)(r->high - addr) + 1;
+  *host = r->host + (addr - r->low);
+  return (len < avail ? len : avail);
+}
+
+// the widest bus access which is naturally aligned at `addr` and fits in `len`
+static int bus_width(paddr_t addr, size_t len) {
+  int w = MUXDEF(CONFIG_ISA64, 8, 4);
+  while (w > 1 && ((addr & (w - 1)) != 0 || len < w)) w >>= 1;
+  return w;
+}
+
+uint8_t* paddr_span(paddr_t addr, size_t len) {
+  uint8_t *host = NULL;
+  return (host_span(addr, len, &host) == len ? host : NULL);
+}
+
+int paddr_gather(paddr_t addr, size_t len, HostSpan *span, int nr_span) {
+  int nr = 0;
+  while (len > 0) {
+    uint8_t *host = NULL;
+    size_t n = host_span(addr, len, &host);
+    if (n == 0 || nr == nr_span) return -1;
+    span[nr ++] = (HostSpan){ .host = host, .len = n };
+    addr += n;
+    len -= n;
+  }
+  return nr;
+}
+
+void paddr_read_block(paddr_t addr, void *buf, size_t len) {
+  uint8_t *p = buf;
+  while (len > 0) {
+    uint8_t *host = NULL;
+    size_t n = host_span(addr, len, &host);
+    if (n > 0) memcpy(p, host, n);
+    else {
+      n = bus_width(addr, len);
+      host_write(p, n, paddr_read(addr, n));
+    }
+    addr += n;
+    p += n;
+    len -= n;
+  }
+}
+
+void paddr_write_block(paddr_t addr, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  while (len > 0) {
+    uint8_t *host = NULL;
+    size_t n = host_span(addr, len, &host);
+    if (n > 0) memcpy(host, p, n);
+    else {
+      n = bus_width(addr, len);
+      paddr_write(addr, n, host_read((void *)p, n));
+    }
+    addr += n;
+    p += n;
+    len -= n;
+  }
+}
+
+void paddr_clear_block(paddr_t addr, size_t len) {
+  static const uint8_t zero[4096] = {};
+  while (len > 0) {
+    uint8_t *host = NULL;
+    size_t n = host_span(addr, len, &host);
+    if (n > 0) {
+      uint8_t *l = host, *r = host + n;
+#ifndef CONFIG_TARGET_AM
+      // writable regions are private anonymous memory, so dropped pages
+      // read back as zero, while read-only regions may be mapped from files
+      uint8_t *pl = (uint8_t *)ROUNDUP(l, PAGE_SIZE), *pr = (uint8_t *)ROUNDDOWN(r, PAGE_SIZE);
+      bool anon = !region_of(addr)->readonly;
+      if (anon && pl < pr && madvise(pl, pr - pl, MADV_DONTNEED) == 0) {
+        memset(l, 0, pl - l);
+        l = pr;
+      }
+#endif
+      memset(l, 0, r - l);
+    } else {
+      n = (len < sizeof(zero) ? len : sizeof(zero));
+      paddr_write_block(addr, zero, n);
+    }
+    addr += n;
+    len -= n;
+  }
+}
+
+#ifndef CONFIG_TARGET_AM
+bool paddr_map_file(paddr_t addr, size_t len, int fd, long off) {
+  uint8_t *host = paddr_span(addr, len);
+  if (host == NULL || len == 0) return false;
+  if (((uintptr_t)host & PAGE_MASK) != 0 || (len & PAGE_MASK) != 0 || (off & PAGE_MASK) != 0) return false;
+  void *p = mmap(host, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off);
+  return (p == host);
+}
+#endif
@@ -15,15 +15,25 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/cachesim.h>
+#include <memory/mtrace.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  IFDEF(CONFIG_CACHESIM, cachesim_access(addr, len, MEM_TYPE_IFETCH));
+  word_t data = paddr_read(addr, len);
+  IFDEF(CONFIG_MTRACE_IFETCH, mtrace_record(cpu.pc, addr, addr, len, MTRACE_IFETCH, data));
+  return data;
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  IFDEF(CONFIG_CACHESIM, cachesim_access(addr, len, MEM_TYPE_READ));
+  word_t data = paddr_read(addr, len);
+  IFDEF(CONFIG_MTRACE, mtrace_record(cpu.pc, addr, addr, len, MTRACE_READ, data));
+  return data;
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_CACHESIM, cachesim_access(addr, len, MEM_TYPE_WRITE));
+  IFDEF(CONFIG_MTRACE, mtrace_record(cpu.pc, addr, addr, len, MTRACE_WRITE, data));
   paddr_write(addr, len, data);
 }
@@ -0,0 +1,161 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Phdr MUXDEF(CONFIG_ISA64, Elf64_Phdr, Elf32_Phdr)
+#define Elf_Shdr MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr)
+#define Elf_Sym  MUXDEF(CONFIG_ISA64, Elf64_Sym , Elf32_Sym )
+#define ELF_ST_TYPE MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE, ELF32_ST_TYPE)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+#define ELF_MACHINE MUXDEF(CONFIG_ISA_x86, EM_386, MUXDEF(CONFIG_ISA_mips32, EM_MIPS, \
+    MUXDEF(CONFIG_ISA_loongarch32r, 258 /* EM_LOONGARCH */, EM_RISCV)))
+
+typedef struct {
+  vaddr_t addr;
+  vaddr_t size;
+  char *name;
+} Symbol;
+
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symtab(const uint8_t *elf, size_t size, const Elf_Ehdr *eh) {
+  if (eh->e_shoff == 0 || eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf_Shdr) > size) return;
+  const Elf_Shdr *sh = (const Elf_Shdr *)(elf + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    const Elf_Shdr *strtab = &sh[sh[i].sh_link];
+    if (sh[i].sh_offset + sh[i].sh_size > size || strtab->sh_offset + strtab->sh_size > size) return;
+    const Elf_Sym *sym = (const Elf_Sym *)(elf + sh[i].sh_offset);
+    const char *str = (const char *)(elf + strtab->sh_offset);
+    int n = sh[i].sh_size / sizeof(Elf_Sym);
+    if (n == 0) return;
+    syms = malloc(sizeof(Symbol) * n);
+    assert(syms);
+    for (int j = 0; j < n; j ++) {
+      if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_name >= strtab->sh_size) continue;
+      syms[nr_sym ++] = (Symbol){ .addr = sym[j].st_value, .size = sym[j].st_size,
+        .name = strdup(str + sym[j].st_name) };
+    }
+    qsort(syms, nr_sym, sizeof(Symbol), sym_cmp);
+    return;
+  }
+}
+
+/* find the function containing `addr`, return NULL if there is no such function */
+const char* elf_symbol(vaddr_t addr, vaddr_t *offset) {
+  int l = 0, r = nr_sym - 1, found = -1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (syms[m].addr <= addr) { found = m; l = m + 1; }
+    else r = m - 1;
+  }
+  if (found == -1 || addr - syms[found].addr >= (syms[found].size ? syms[found].size : 1)) return NULL;
+  if (offset) *offset = addr - syms[found].addr;
+  return syms[found].name;
+}
+
+static void load_segment(const uint8_t *elf, int fd, const Elf_Phdr *ph) {
+  paddr_t addr = ph->p_paddr;
+  size_t filesz = ph->p_filesz;
+  size_t off = ph->p_offset;
+
+  Log("Load segment [" FMT_PADDR ", " FMT_PADDR ") filesz = 0x%zx",
+      addr, (paddr_t)(addr + ph->p_memsz), filesz);
+
+#ifdef CONFIG_ELF_MMAP_RO
+  // map the page-aligned middle part of read-only segments directly from the file
+  if (!(ph->p_flags & PF_W) && ((addr - off) & PAGE_MASK) == 0) {
+    size_t head = ROUNDUP(addr, PAGE_SIZE) - addr;
+    if (head < filesz) {
+      size_t body = ROUNDDOWN(filesz - head, PAGE_SIZE);
+      if (body > 0 && paddr_map_file(addr + head, body, fd, off + head)) {
+        paddr_write_block(addr, elf + off, head);
+        paddr_write_block(addr + head + body, elf + off + head + body, filesz - head - body);
+        filesz = 0;
+      }
+    }
+  }
+#endif
+
+  if (filesz > 0) paddr_write_block(addr, elf + off, filesz);
+  if (ph->p_memsz > ph->p_filesz) {
+    // .bss
+    paddr_clear_block(addr + ph->p_filesz, ph->p_memsz - ph->p_filesz);
+  }
+}
+
+/* load the ELF file `img_file` and set the entry, return the size of memory
+ * covered from RESET_VECTOR, or -1 if `img_file` is not an ELF file */
+long load_elf(const char *img_file) {
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  size_t size = st.st_size;
+  if (size < sizeof(Elf_Ehdr)) { close(fd); return -1; }
+
+  uint8_t *elf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(elf != MAP_FAILED);
+
+  const Elf_Ehdr *eh = (const Elf_Ehdr *)elf;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) {
+    munmap(elf, size);
+    close(fd);
+    return -1;
+  }
+
+  Assert(eh->e_ident[EI_CLASS] == ELF_CLASS, "'%s' is not a %d-bit ELF file",
+      img_file, MUXDEF(CONFIG_ISA64, 64, 32));
+  Assert(eh->e_machine == ELF_MACHINE, "'%s' is not built for %s", img_file, str(__GUEST_ISA__));
+  Assert(eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf_Phdr) <= size,
+      "'%s' has corrupted program headers", img_file);
+
+  Log("The image is %s, ELF entry = " FMT_WORD, img_file, (word_t)eh->e_entry);
+
+  paddr_t end = RESET_VECTOR;
+  const Elf_Phdr *ph = (const Elf_Phdr *)(elf + eh->e_phoff);
+  for (int i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    Assert(ph[i].p_offset + ph[i].p_filesz <= size && ph[i].p_filesz <= ph[i].p_memsz,
+        "'%s' has a corrupted segment", img_file);
+    load_segment(elf, fd, &ph[i]);
+    if (ph[i].p_paddr + ph[i].p_memsz > end) end = ph[i].p_paddr + ph[i].p_memsz;
+  }
+
+  cpu.pc = eh->e_entry;
+  load_symtab(elf, size, eh);
+  Log("%d function symbols are loaded", nr_sym);
+
+  munmap(elf, size);
+  close(fd);
+  return end - RESET_VECTOR;
+}
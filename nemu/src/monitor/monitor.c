@@ -19,8 +19,11 @@
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
+void init_cachesim();
+void init_mtrace();
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
+void init_journal(const char *path, bool replay);
 void init_sdb();
 void init_disasm(const char *triple);
 
@@ -45,6 +48,10 @@ static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static char *journal_file = NULL;
+static bool journal_replay = false;
+
+long load_elf(const char *img_file);
 
 static long load_img() {
   if (img_file == NULL) {
@@ -52,6 +59,9 @@ static long load_img() {
     return 4096; // built-in image size
   }
 
+  long elf_size = load_elf(img_file);
+  if (elf_size >= 0) return elf_size;
+
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
@@ -61,7 +71,18 @@ static long load_img() {
   Log("The image is %s, size = %ld", img_file, size);
 
   fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
+  uint8_t *host = paddr_span(RESET_VECTOR, size);
+  int ret;
+  if (host != NULL) {
+    // read the image directly into guest memory
+    ret = fread(host, size, 1, fp);
+  } else {
+    uint8_t *buf = malloc(size);
+    assert(buf);
+    ret = fread(buf, size, 1, fp);
+    paddr_write_block(RESET_VECTOR, buf, size);
+    free(buf);
+  }
   assert(ret == 1);
 
   fclose(fp);
@@ -74,16 +95,20 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"record"   , required_argument, NULL, 'r'},
+    {"replay"   , required_argument, NULL, 'R'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:r:R:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'r': journal_file = optarg; journal_replay = false; break;
+      case 'R': journal_file = optarg; journal_replay = true; break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +116,8 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-r,--record=FILE        record the device inputs to FILE\n");
+        printf("\t-R,--replay=FILE        replay the device inputs recorded in FILE\n");
         printf("\n");
         exit(0);
     }
@@ -113,6 +140,19 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
+  /* Initialize the cache simulator. */
+  IFDEF(CONFIG_CACHESIM, init_cachesim());
+
+  /* Initialize the memory tracer. */
+  IFDEF(CONFIG_MTRACE, init_mtrace());
+
+  /* Open the journal of device inputs. */
+#ifdef CONFIG_JOURNAL
+  init_journal(journal_file, journal_replay);
+#else
+  Assert(journal_file == NULL, "Enable JOURNAL in menuconfig to record or replay the device inputs");
+#endif
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -145,7 +185,7 @@ static long load_img() {
   extern char bin_start, bin_end;
   size_t size = &bin_end - &bin_start;
   Log("img size = %ld", size);
-  memcpy(guest_to_host(RESET_VECTOR), &bin_start, size);
+  paddr_write_block(RESET_VECTOR, &bin_start, size);
   return size;
 }
 
@@ -84,20 +84,26 @@ static int cmd_info(char *args) {
 static int cmd_x(char *args) {
 	char *arg1 = strtok(NULL, " ");
 	char *arg2 = strtok(NULL, " ");
-	int N = 0;
-	vaddr_t addr = 0;
 
 	if(arg1 == NULL || arg2 == NULL){
 		printf("invalid input!\n");
+		return 0;
 	}
-	else {
-		N = (vaddr_t)atoi(arg1);
-    addr = (vaddr_t)strtoll(arg2, NULL, 16);
-		//printf("the input value is %u \t %x \n", N, addr);
-		for(int i = 0; i < N; i++,addr++){
-			printf("the value of 0x%lu is 0x%lu \n", addr, paddr_read(addr, 8));
-		}
+
+	int N = atoi(arg1);
+	paddr_t addr = (paddr_t)strtoull(arg2, NULL, 16);
+	if(N <= 0) return 0;
+
+	// fetch the whole range at once instead of one bus access per word
+	uint32_t *buf = malloc(sizeof(uint32_t) * N);
+	assert(buf);
+	paddr_read_block(addr, buf, sizeof(uint32_t) * N);
+	for(int i = 0; i < N; i++){
+		if(i % 4 == 0) printf(FMT_PADDR ":", addr + i * 4);
+		printf(" 0x%08" PRIx32, buf[i]);
+		if(i % 4 == 3 || i == N - 1) printf("\n");
 	}
+	free(buf);
 
 	return 0;
 }
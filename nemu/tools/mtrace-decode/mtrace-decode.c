@@ -0,0 +1,118 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <memory/mtrace.h>
+
+// decode the binary trace written by NEMU with CONFIG_MTRACE
+
+#define NR_BATCH 4096
+
+static const char *type_str[] = {
+  [MTRACE_IFETCH] = "X", [MTRACE_READ] = "R", [MTRACE_WRITE] = "W",
+};
+
+static uint64_t addr_low = 0, addr_high = UINT64_MAX;
+static uint64_t pc_low = 0, pc_high = UINT64_MAX;
+static bool summary = false;
+
+static void usage(const char *name) {
+  printf("Usage: %s [OPTION...] TRACE_FILE\n\n", name);
+  printf("\t-a,--addr=LOW:HIGH      only show accesses to addresses in [LOW, HIGH]\n");
+  printf("\t-p,--pc=LOW:HIGH        only show accesses issued by pc in [LOW, HIGH]\n");
+  printf("\t-s,--summary            only print the number of accesses of each type\n");
+  printf("\n");
+}
+
+static void parse_range(const char *s, uint64_t *low, uint64_t *high) {
+  char *end;
+  *low = strtoull(s, &end, 0);
+  if (*end != ':') { fprintf(stderr, "invalid range '%s'\n", s); exit(1); }
+  *high = strtoull(end + 1, NULL, 0);
+}
+
+static int parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"addr"   , required_argument, NULL, 'a'},
+    {"pc"     , required_argument, NULL, 'p'},
+    {"summary", no_argument      , NULL, 's'},
+    {"help"   , no_argument      , NULL, 'h'},
+    {0        , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "-sa:p:h", table, NULL)) != -1) {
+    switch (o) {
+      case 'a': parse_range(optarg, &addr_low, &addr_high); break;
+      case 'p': parse_range(optarg, &pc_low, &pc_high); break;
+      case 's': summary = true; break;
+      case 1: return optind - 1;
+      default: usage(argv[0]); exit(0);
+    }
+  }
+  usage(argv[0]);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  const char *file = argv[parse_args(argc, argv)];
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) { perror(file); return 1; }
+
+  MTraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, MTRACE_MAGIC, sizeof(MTRACE_MAGIC)) != 0) {
+    fprintf(stderr, "%s is not a memory trace\n", file);
+    return 1;
+  }
+  if (h.version != MTRACE_VERSION || h.record_size != sizeof(MTraceRecord)) {
+    fprintf(stderr, "%s: unsupported version %u (record size = %u)\n", file, h.version, h.record_size);
+    return 1;
+  }
+
+  static MTraceRecord buf[NR_BATCH];
+  uint64_t count[3] = {0}, total = 0;
+  size_t n;
+  while ((n = fread(buf, sizeof(buf[0]), NR_BATCH, fp)) > 0) {
+    for (size_t i = 0; i < n; i ++) {
+      MTraceRecord *r = &buf[i];
+      total ++;
+      if (r->paddr < addr_low || r->paddr > addr_high) continue;
+      if (r->pc < pc_low || r->pc > pc_high) continue;
+      if (r->type > MTRACE_WRITE) {
+        fprintf(stderr, "corrupted record #%" PRIu64 "\n", total - 1);
+        return 1;
+      }
+      count[r->type] ++;
+      if (summary) continue;
+      // only the low `len` bytes of the data are meaningful
+      uint64_t data = (r->len < 8 ? r->data & ((1ull << (r->len * 8)) - 1) : r->data);
+      printf("pc = 0x%016" PRIx64 " %s vaddr = 0x%016" PRIx64 " paddr = 0x%016" PRIx64
+          " len = %d data = 0x%0*" PRIx64 "\n", r->pc, type_str[r->type],
+          r->vaddr, r->paddr, r->len, r->len * 2, data);
+    }
+  }
+  fclose(fp);
+
+  if (summary) {
+    printf("records = %" PRIu64 ", matched: ifetch = %" PRIu64 ", read = %" PRIu64 ", write = %" PRIu64 "\n",
+        total, count[MTRACE_IFETCH], count[MTRACE_READ], count[MTRACE_WRITE]);
+  }
+  return 0;
+}